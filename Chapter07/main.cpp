@@ -1,5 +1,6 @@
 #include "recipe_7_01.h"
 #include "recipe_7_02.h"
+#include "recipe_7_02_1.h"
 #include "recipe_7_03.h"
 #include "recipe_7_04.h"
 #include "recipe_7_05.h"
@@ -10,11 +11,13 @@
 #include "recipe_7_10.h"
 #include "recipe_7_11.h"
 #include "recipe_7_12.h"
+#include "recipe_7_12_1.h"
 
 int main()
 {
   recipe_7_01::execute();
   recipe_7_02::execute();
+  recipe_7_02_1::execute();
   recipe_7_03::execute();
   recipe_7_04::execute();
   recipe_7_05::execute();
@@ -25,6 +28,7 @@ int main()
   recipe_7_10::execute();
   recipe_7_11::execute();
   recipe_7_12::execute();
+  recipe_7_12_1::execute();
 
   // fs::remove("sample.bin");
 
@@ -2,13 +2,26 @@
 
 #include <cstring>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <numeric>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace recipe_7_01 {
   bool write_data(char const* const filename, char const* const data, size_t const size)
   {
@@ -53,6 +66,228 @@ namespace recipe_7_01 {
     return readbytes;
   }
 
+  // read_data() copies the whole file into a buffer supplied by the caller, so a file
+  // occupies memory twice: once in the page cache of the operating system and once in
+  // the buffer. Mapping the file into the address space of the process gives direct,
+  // read-only access to the pages of the page cache instead. Nothing is copied, the pages
+  // are loaded on first access, and the operating system can drop them again under
+  // memory pressure, since they are backed by the file.
+
+  // The access pattern is passed to madvise(): with sequential, the kernel reads ahead
+  // aggressively and may free the pages behind the reader; with random, it disables the
+  // read-ahead, which would only load pages that are not needed.
+  enum class access_pattern { normal, sequential, random };
+
+  // A read-only view of a file mapped into memory; the file is unmapped when the object
+  // is destroyed. On systems without mmap(), the file is read into a buffer instead.
+  class mapped_file {
+  public:
+    mapped_file() = default;
+
+    explicit mapped_file(char const* const filename,
+                         access_pattern const pattern = access_pattern::sequential)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      auto const fd = ::open(filename, O_RDONLY);
+      if (fd < 0)
+        return;
+
+      struct stat info;
+      if (::fstat(fd, &info) == 0) {
+        length = static_cast<size_t>(info.st_size);
+        if (length == 0)
+          opened = true;
+        else {
+          auto const address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (address != MAP_FAILED) {
+            mapping = static_cast<char const*>(address);
+            opened = true;
+            advise(pattern);
+          }
+        }
+      }
+
+      // The mapping remains valid after the file descriptor is closed.
+      ::close(fd);
+#else
+      (void)pattern;
+      opened = read_data(filename, [this](size_t const size) {
+                 buffer.resize(size);
+                 return buffer.data();
+               }) == buffer.size();
+      mapping = buffer.data();
+      length = buffer.size();
+#endif
+    }
+
+    ~mapped_file()
+    {
+      unmap();
+    }
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+    {
+      *this = std::move(other);
+    }
+
+    mapped_file& operator=(mapped_file&& other) noexcept
+    {
+      if (this != &other) {
+        unmap();
+        mapping = std::exchange(other.mapping, nullptr);
+        length = std::exchange(other.length, 0);
+        opened = std::exchange(other.opened, false);
+#if !defined(__unix__) && !defined(__APPLE__)
+        buffer = std::move(other.buffer);
+#endif
+      }
+      return *this;
+    }
+
+    bool is_open() const noexcept { return opened; }
+    char const* data() const noexcept { return mapping; }
+    size_t size() const noexcept { return length; }
+    char const* begin() const noexcept { return mapping; }
+    char const* end() const noexcept { return mapping + length; }
+
+    std::string_view view() const noexcept
+    {
+      return length == 0 ? std::string_view() : std::string_view(mapping, length);
+    }
+
+    // Changes the access pattern for the whole mapping.
+    void advise(access_pattern const pattern) const noexcept
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      if (length == 0)
+        return;
+
+      auto const advice = pattern == access_pattern::sequential ? MADV_SEQUENTIAL
+                          : pattern == access_pattern::random   ? MADV_RANDOM
+                                                                : MADV_NORMAL;
+      ::madvise(const_cast<char*>(mapping), length, advice);
+#else
+      (void)pattern;
+#endif
+    }
+
+  private:
+    void unmap() noexcept
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      if (mapping != nullptr)
+        ::munmap(const_cast<char*>(mapping), length);
+#endif
+      mapping = nullptr;
+      length = 0;
+      opened = false;
+    }
+
+    char const* mapping = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#if !defined(__unix__) && !defined(__APPLE__)
+    std::vector<char> buffer;
+#endif
+  };
+
+  // The memory-mapped counterpart of read_data(): instead of filling a buffer, returns a
+  // view of the file. Check is_open() for errors.
+  inline mapped_file map_data(char const* const filename,
+                              access_pattern const pattern = access_pattern::sequential)
+  {
+    return mapped_file(filename, pattern);
+  }
+
+  // Compares reading a large file with ifstream::read() (read_data()), with an
+  // istreambuf_iterator and with a memory mapping. Every variant goes through all the
+  // bytes, so that the mapped pages are actually loaded.
+  void test_read_performance()
+  {
+    size_t const size = 32 * 1024 * 1024;
+    char const* const filename = "sample_large.bin";
+
+    {
+      std::vector<char> data(size);
+      for (size_t i = 0; i < size; ++i)
+        data[i] = static_cast<char>(i * 31 + (i >> 12));
+      if (!write_data(filename, data.data(), data.size()))
+        return;
+    }
+
+    auto const checksum = [](char const* first, char const* last) {
+      return std::accumulate(first, last, 0ULL,
+                             [](unsigned long long const sum, char const c) {
+                               return sum + static_cast<unsigned char>(c);
+                             });
+    };
+
+    auto const measure = [](auto&& read) {
+      auto const start = std::chrono::high_resolution_clock::now();
+      auto const sum = read();
+      auto const end = std::chrono::high_resolution_clock::now();
+      return std::make_pair(
+        sum, std::chrono::duration<double, std::milli>(end - start).count());
+    };
+
+    // The first read brings the file into the page cache, so that all the variants
+    // below read from memory.
+    std::vector<char> expected;
+    read_data(filename, [&expected](size_t const length) {
+      expected.resize(length);
+      return expected.data();
+    });
+    [[maybe_unused]] auto const sum =
+      checksum(expected.data(), expected.data() + expected.size());
+    expected = std::vector<char>();
+
+    auto const tr = measure([&] {
+      std::vector<char> input;
+      read_data(filename, [&input](size_t const length) {
+        input.resize(length);
+        return input.data();
+      });
+      return checksum(input.data(), input.data() + input.size());
+    });
+
+    auto const ti = measure([&] {
+      std::ifstream ifile(filename, std::ios::binary);
+      std::vector<char> input(std::istreambuf_iterator<char>(ifile),
+                              std::istreambuf_iterator<char>{});
+      return checksum(input.data(), input.data() + input.size());
+    });
+
+    auto const ts = measure([&] {
+      auto const file = map_data(filename, access_pattern::sequential);
+      return checksum(file.begin(), file.end());
+    });
+
+    auto const tn = measure([&] {
+      auto const file = map_data(filename, access_pattern::normal);
+      return checksum(file.begin(), file.end());
+    });
+
+    assert(tr.first == sum && ti.first == sum && ts.first == sum && tn.first == sum);
+
+    std::cout << std::left << std::setw(26) << "method" << std::right << std::setw(10)
+              << "ms" << std::right << std::setw(10) << "MB/s" << std::endl;
+
+    for (auto const& [name, t] : { std::make_pair("ifstream::read", tr.second),
+                                   std::make_pair("istreambuf_iterator", ti.second),
+                                   std::make_pair("mmap (sequential)", ts.second),
+                                   std::make_pair("mmap (normal)", tn.second) }) {
+      std::cout << std::left << std::setw(26) << name << std::right << std::setw(10)
+                << std::fixed << std::setprecision(1) << t << std::right << std::setw(10)
+                << size / (1024.0 * 1024.0) / (t / 1000) << std::defaultfloat
+                << std::setprecision(6) << std::endl;
+    }
+
+    std::remove(filename);
+  }
+
   void execute()
   {
     std::cout << "Recipe 7.01: Reading and writing raw data from/to binary files.\n"
@@ -217,5 +452,28 @@ namespace recipe_7_01 {
 
       delete[] input;
     }
+
+    {
+      std::cout << "\nMap the file into memory instead of reading it:\n";
+
+      if (write_data("sample.bin", reinterpret_cast<char*>(output.data()),
+                     output.size())) {
+        auto const file = map_data("sample.bin");
+        if (file.is_open()) {
+          std::cout << "Input and Output are "
+                    << (file.size() == output.size()
+                            && memcmp(output.data(), file.data(), output.size()) == 0
+                          ? "equal."
+                          : "not equal.")
+                    << std::endl;
+        }
+      }
+    }
+
+    {
+      std::cout << "\nRead a 32 MB file with different methods:\n";
+
+      test_read_performance();
+    }
   }
 }
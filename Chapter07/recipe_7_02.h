@@ -8,9 +8,23 @@
 // https://uscilab.github.io/cereal/
 // https://stackoverflow.com/questions/3637581/fastest-c-serialization
 
+#include "recipe_7_01.h"
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 namespace recipe_7_02 {
@@ -74,6 +88,8 @@ namespace recipe_7_02 {
     // overload operator<< and operator>>:
     friend std::ofstream& operator<<(std::ofstream& ofile, foo const& f);
     friend std::ifstream& operator>>(std::ifstream& ifile, foo& f);
+
+    friend bool write_records(std::ofstream& ofile, std::vector<foo> const& values);
   };
 
   std::ofstream& operator<<(std::ofstream& ofile, foo const& f)
@@ -99,6 +115,210 @@ namespace recipe_7_02 {
     return ifile;
   }
 
+  // The magic numbers of the formats below are stored in the byte order of the writer,
+  // so a file from a machine with the other byte order has them reversed.
+  constexpr std::uint32_t byte_swap(std::uint32_t const value)
+  {
+    return (value >> 24) | ((value >> 8) & 0x0000ff00) | ((value << 8) & 0x00ff0000)
+           | (value << 24);
+  }
+
+  // The formats above have no header, so a reader cannot tell which version of the
+  // class wrote the data, and reading always copies every string into a std::string.
+  // The record format below is written once and then accessed in place, typically
+  // straight from a memory-mapped file (see recipe 7.01):
+  //  - a fixed-size header with a magic number, the version of the format, a byte order
+  //    mark and the number of records;
+  //  - a table with the offset of every record, so that any record can be reached
+  //    without reading the ones before it;
+  //  - the records: the fixed-size fields, followed by the characters of the string.
+  // All the integers are stored with fixed sizes, in the byte order of the writer; a
+  // reader with a different byte order, or an unknown major version, rejects the data.
+  // A new minor version may only append fields to the fixed part of the records; the
+  // header stores the size of that part, so older readers know where the string starts
+  // and skip the fields they do not know. Records are aligned to 4 bytes, and the offsets
+  // are 32-bit, so the data cannot exceed 4 GiB.
+  namespace record_format {
+    constexpr std::uint32_t magic = 0x31464f46; // "FOF1" in little-endian order
+    constexpr std::uint32_t byte_order_mark = 0x01020304;
+    constexpr std::uint16_t major_version = 1;
+    constexpr std::uint16_t minor_version = 0;
+
+    struct header {
+      std::uint32_t magic;
+      std::uint32_t byte_order;
+      std::uint16_t major;
+      std::uint16_t minor;
+      std::uint32_t count;
+      std::uint32_t record_size; // the size of the fixed part of a record
+      std::uint32_t reserved;
+    };
+
+    struct record {
+      std::int32_t i;
+      std::uint32_t length; // of the string
+      char c;
+      char padding[3];
+    };
+
+    static_assert(sizeof(header) == 24 && sizeof(record) == 12,
+                  "the layout of the format must not depend on the compiler");
+
+    constexpr std::uint64_t align(std::uint64_t const offset)
+    {
+      return (offset + 3) & ~std::uint64_t{ 3 };
+    }
+  }
+
+  // Returns false, without writing anything, if the data would not fit in 4 GiB.
+  bool write_records(std::ofstream& ofile, std::vector<foo> const& values)
+  {
+    using namespace record_format;
+
+    // The layout is computed with 64-bit offsets, which cannot overflow, and then
+    // checked against the 32-bit offsets of the format.
+    auto const limit = std::uint64_t{ std::numeric_limits<std::uint32_t>::max() };
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(values.size());
+
+    auto const table_size = std::uint64_t{ values.size() } * sizeof(std::uint32_t);
+    auto offset = sizeof(header) + table_size;
+    for (auto const& value : values) {
+      if (offset > limit)
+        return false;
+      offsets.push_back(static_cast<std::uint32_t>(offset));
+      offset = align(offset + sizeof(record) + value.s.size());
+    }
+    if (offset > limit)
+      return false;
+
+    header const h{ magic,
+                    byte_order_mark,
+                    major_version,
+                    minor_version,
+                    static_cast<std::uint32_t>(values.size()),
+                    sizeof(record),
+                    0 };
+    ofile.write(reinterpret_cast<char const*>(&h), sizeof(h));
+    ofile.write(reinterpret_cast<char const*>(offsets.data()),
+                static_cast<std::streamsize>(table_size));
+
+    char const zeros[4] = {};
+    for (auto const& value : values) {
+      record r{};
+      r.i = value.i;
+      r.length = static_cast<std::uint32_t>(value.s.size());
+      r.c = value.c;
+      ofile.write(reinterpret_cast<char const*>(&r), sizeof(r));
+      ofile.write(value.s.data(), value.s.size());
+
+      auto const end = sizeof(record) + value.s.size();
+      ofile.write(zeros, static_cast<std::streamsize>(align(end) - end));
+    }
+
+    return !ofile.fail();
+  }
+
+  // A read-only accessor for a record that stays in the buffer; nothing is copied until
+  // to_foo() is called.
+  class foo_view {
+    char const* data;
+    std::uint32_t record_size;
+
+    record_format::record fields() const
+    {
+      record_format::record r;
+      std::memcpy(&r, data, sizeof(r));
+      return r;
+    }
+
+  public:
+    foo_view(char const* const data, std::uint32_t const record_size)
+      : data(data), record_size(record_size)
+    {
+    }
+
+    int i() const { return fields().i; }
+    char c() const { return fields().c; }
+
+    std::string_view s() const
+    {
+      return { data + record_size, fields().length };
+    }
+
+    foo to_foo() const
+    {
+      return foo{ i(), c(), std::string(s()) };
+    }
+  };
+
+  // Validates the header and the offset table of a buffer written by write_records()
+  // and gives access to the records in place. Throws std::runtime_error if the buffer
+  // was not written in a compatible version of the format. The buffer must outlive the
+  // view.
+  class foo_records_view {
+    std::string_view buffer;
+    std::uint32_t count = 0;
+    std::uint32_t record_size = 0;
+
+    std::uint32_t offset(size_t const index) const
+    {
+      std::uint32_t value;
+      std::memcpy(&value,
+                  buffer.data() + sizeof(record_format::header)
+                    + index * sizeof(std::uint32_t),
+                  sizeof(value));
+      return value;
+    }
+
+  public:
+    explicit foo_records_view(std::string_view const data) : buffer(data)
+    {
+      using namespace record_format;
+
+      header h;
+      if (buffer.size() < sizeof(h))
+        throw std::runtime_error("records: truncated header");
+      std::memcpy(&h, buffer.data(), sizeof(h));
+
+      if (h.magic != magic && h.magic != byte_swap(magic))
+        throw std::runtime_error("records: not a record file");
+      if (h.byte_order != byte_order_mark)
+        throw std::runtime_error("records: written with a different byte order");
+      if (h.major != major_version)
+        throw std::runtime_error("records: unsupported version " + std::to_string(h.major)
+                                 + "." + std::to_string(h.minor));
+      if (h.record_size < sizeof(record))
+        throw std::runtime_error("records: invalid record size");
+
+      count = h.count;
+      record_size = h.record_size;
+      if ((buffer.size() - sizeof(h)) / sizeof(std::uint32_t) < count)
+        throw std::runtime_error("records: truncated offset table");
+
+      // Every record must lie entirely within the buffer, so that the accessors never
+      // read past its end.
+      for (size_t i = 0; i < count; ++i) {
+        auto const start = offset(i);
+        if (start > buffer.size() || buffer.size() - start < record_size)
+          throw std::runtime_error("records: record out of bounds");
+
+        std::uint32_t length;
+        std::memcpy(&length, buffer.data() + start + offsetof(record, length),
+                    sizeof(length));
+        if (buffer.size() - start - record_size < length)
+          throw std::runtime_error("records: string out of bounds");
+      }
+    }
+
+    size_t size() const noexcept { return count; }
+
+    foo_view operator[](size_t const index) const
+    {
+      return foo_view(buffer.data() + offset(index), record_size);
+    }
+  };
+
   void test1()
   {
     std::cout << "Serializing simple POD:\n";
@@ -164,6 +384,89 @@ namespace recipe_7_02 {
     return f1.a == f2.a && f1.b == f2.b && f1.c[0] == f2.c[0] && f1.c[1] == f2.c[1];
   }
 
+  // Writing and reading a vector of POD values one element at a time costs a call to
+  // write() or read() per element, and on reading, the vector grows by reallocation as
+  // the elements are appended. For trivially copyable types, the whole vector can be
+  // written as one contiguous block, preceded by a header with the number of elements,
+  // so that the reader can size the vector up front and read the block with a single
+  // call. The header also describes the layout of the elements (their size and
+  // alignment, and the byte order of the writer), which the reader can check: the data
+  // is only meaningful to a program that uses the same layout.
+  enum class layout_check { verify, skip };
+
+  namespace span_format {
+    constexpr std::uint32_t magic = 0x31505346; // "FSP1" in little-endian order
+    constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+    struct header {
+      std::uint32_t magic;
+      std::uint32_t byte_order;
+      std::uint32_t element_size;
+      std::uint32_t element_alignment;
+      std::uint64_t count;
+    };
+
+    static_assert(sizeof(header) == 24,
+                  "the layout of the format must not depend on the compiler");
+  }
+
+  template <typename T>
+  bool write_span(std::ofstream& ofile, T const* const data, size_t const count)
+  {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "only trivially copyable types can be written as raw bytes");
+
+    span_format::header const h{ span_format::magic, span_format::byte_order_mark,
+                                 sizeof(T), alignof(T), count };
+    ofile.write(reinterpret_cast<char const*>(&h), sizeof(h));
+    ofile.write(reinterpret_cast<char const*>(data),
+                static_cast<std::streamsize>(count * sizeof(T)));
+
+    return !ofile.fail();
+  }
+
+  template <typename T>
+  bool write_span(std::ofstream& ofile, std::vector<T> const& values)
+  {
+    return write_span(ofile, values.data(), values.size());
+  }
+
+  // Replaces the content of values with the elements of a block written by
+  // write_span(). Returns false if the data is truncated or, unless the check is
+  // skipped, was written with a different layout.
+  template <typename T>
+  bool read_into(std::ifstream& ifile, std::vector<T>& values,
+                 layout_check const check = layout_check::verify)
+  {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "only trivially copyable types can be read as raw bytes");
+
+    span_format::header h;
+    if (!ifile.read(reinterpret_cast<char*>(&h), sizeof(h))
+        || (h.magic != span_format::magic && h.magic != byte_swap(span_format::magic)))
+      return false;
+
+    if (check == layout_check::verify
+        && (h.byte_order != span_format::byte_order_mark || h.element_size != sizeof(T)
+            || h.element_alignment != alignof(T)))
+      return false;
+
+    // A corrupted count must not lead to a huge allocation: the block must fit in what
+    // is left of the file.
+    auto const position = ifile.tellg();
+    ifile.seekg(0, std::ios_base::end);
+    auto const available = static_cast<std::uint64_t>(ifile.tellg() - position);
+    ifile.seekg(position);
+    if (h.count > available / sizeof(T))
+      return false;
+
+    values.resize(static_cast<size_t>(h.count));
+    ifile.read(reinterpret_cast<char*>(values.data()),
+               static_cast<std::streamsize>(values.size() * sizeof(T)));
+
+    return !ifile.fail();
+  }
+
   void test3()
   {
     std::cout << "To serialize/deserialize POD types that do not contain pointers, use "
@@ -206,6 +509,191 @@ namespace recipe_7_02 {
     }
   }
 
+  // Compares reading a file of records with foo::read() (one object at a time, every
+  // string copied into a std::string) with accessing the records in place in a mapped
+  // file.
+  void test4()
+  {
+    std::cout << "Reading records with foo::read() and in place from a mapped file:\n";
+
+    int const no_of_records = 500000;
+    std::mt19937 engine(42);
+    std::uniform_int_distribution<> length(0, 32);
+    std::uniform_int_distribution<> letter('a', 'z');
+
+    std::vector<foo> output;
+    output.reserve(no_of_records);
+    for (int n = 0; n < no_of_records; ++n) {
+      std::string text(static_cast<size_t>(length(engine)), ' ');
+      for (auto& ch : text)
+        ch = static_cast<char>(letter(engine));
+      output.emplace_back(n, static_cast<char>(letter(engine)), text);
+    }
+
+    {
+      std::ofstream ofile("sample_fields.bin", std::ios::binary);
+      for (auto const& value : output)
+        value.write(ofile);
+    }
+
+    {
+      std::ofstream ofile("sample_records.bin", std::ios::binary);
+      write_records(ofile, output);
+    }
+
+    auto const measure = [](auto&& read) {
+      auto const start = std::chrono::high_resolution_clock::now();
+      auto const result = read();
+      auto const end = std::chrono::high_resolution_clock::now();
+      return std::make_pair(
+        result, std::chrono::duration<double, std::milli>(end - start).count());
+    };
+
+    // foo::read() has to materialize every object. The records can be used in place,
+    // or converted to foo objects when they are needed as such.
+    auto const tr = measure([] {
+      std::vector<foo> input;
+      std::ifstream ifile("sample_fields.bin", std::ios::binary);
+      foo value;
+      while (value.read(ifile))
+        input.push_back(value);
+      return input;
+    });
+
+    auto const tv = measure([] {
+      auto const file = recipe_7_01::map_data("sample_records.bin");
+      foo_records_view const records(file.view());
+
+      long long sum = 0;
+      for (size_t n = 0; n < records.size(); ++n) {
+        auto const r = records[n];
+        sum += r.i() + r.c() + static_cast<long long>(r.s().size());
+      }
+      return sum;
+    });
+
+    auto const tm = measure([] {
+      auto const file = recipe_7_01::map_data("sample_records.bin");
+      foo_records_view const records(file.view());
+
+      std::vector<foo> input;
+      input.reserve(records.size());
+      for (size_t n = 0; n < records.size(); ++n)
+        input.push_back(records[n].to_foo());
+      return input;
+    });
+
+    assert(tr.first == output && tm.first == output);
+
+    std::cout << std::left << std::setw(26) << "method" << std::right << std::setw(10)
+              << "ms" << std::right << std::setw(14) << "Mrecords/s" << std::endl;
+
+    for (auto const& [name, t] : { std::make_pair("foo::read()", tr.second),
+                                   std::make_pair("in place", tv.second),
+                                   std::make_pair("in place + to_foo()", tm.second) }) {
+      std::cout << std::left << std::setw(26) << name << std::right << std::setw(10)
+                << std::fixed << std::setprecision(1) << t << std::right << std::setw(14)
+                << no_of_records / t / 1000 << std::defaultfloat << std::setprecision(6)
+                << std::endl;
+    }
+
+    {
+      // A file written by an incompatible version, or on a machine with the other byte
+      // order, is rejected instead of being misinterpreted.
+      using record_format::byte_order_mark;
+      using record_format::magic;
+      std::uint32_t const size = sizeof(record_format::record);
+
+      for (auto const& h :
+           { record_format::header{ magic, byte_order_mark, 2, 0, 0, size, 0 },
+             record_format::header{ byte_swap(magic), byte_swap(byte_order_mark), 0x0100,
+                                    0, 0, byte_swap(size), 0 } }) {
+        std::string data(sizeof(h), '\0');
+        std::memcpy(&data[0], &h, sizeof(h));
+        try {
+          foo_records_view const records(data);
+        } catch (std::runtime_error const& e) {
+          std::cout << e.what() << "\n";
+        }
+      }
+    }
+
+    std::cout << "\n";
+    std::remove("sample_fields.bin");
+    std::remove("sample_records.bin");
+  }
+
+  // Compares writing and reading 10^7 foopod values one at a time (as in test3()) with
+  // write_span() and read_into().
+  void test5()
+  {
+    std::cout << "Writing and reading POD values one by one and as a block:\n";
+
+    size_t const no_of_records = 10000000;
+    std::vector<foopod> output(no_of_records);
+    for (size_t n = 0; n < no_of_records; ++n) {
+      output[n] = { n % 2 == 0,
+                    static_cast<char>('a' + n % 26),
+                    { static_cast<int>(n), static_cast<int>(n * 7) } };
+    }
+
+    auto const measure = [](auto&& f) {
+      auto const start = std::chrono::high_resolution_clock::now();
+      f();
+      auto const end = std::chrono::high_resolution_clock::now();
+      return std::chrono::duration<double>(end - start).count();
+    };
+
+    auto const tw1 = measure([&] {
+      std::ofstream ofile("sample_pods.bin", std::ios::binary);
+      for (auto const& value : output)
+        ofile.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    });
+
+    std::vector<foopod> input1;
+    auto const tr1 = measure([&] {
+      std::ifstream ifile("sample_pods.bin", std::ios::binary);
+      while (true) {
+        foopod value;
+        ifile.read(reinterpret_cast<char*>(&value), sizeof(value));
+
+        if (ifile.fail() || ifile.eof())
+          break;
+
+        input1.push_back(value);
+      }
+    });
+
+    auto const tw2 = measure([&] {
+      std::ofstream ofile("sample_pods.bin", std::ios::binary);
+      write_span(ofile, output);
+    });
+
+    std::vector<foopod> input2;
+    auto const tr2 = measure([&] {
+      std::ifstream ifile("sample_pods.bin", std::ios::binary);
+      read_into(ifile, input2);
+    });
+
+    assert(input1 == output && input2 == output);
+
+    std::cout << std::left << std::setw(16) << "method" << std::right << std::setw(16)
+              << "write Mrec/s" << std::right << std::setw(16) << "read Mrec/s"
+              << std::endl;
+
+    for (auto const& [name, tw, tr] : { std::make_tuple("per element", tw1, tr1),
+                                        std::make_tuple("block", tw2, tr2) }) {
+      std::cout << std::left << std::setw(16) << name << std::fixed
+                << std::setprecision(1) << std::right << std::setw(16)
+                << no_of_records / tw / 1e6 << std::right << std::setw(16)
+                << no_of_records / tr / 1e6 << std::defaultfloat << std::setprecision(6)
+                << std::endl;
+    }
+
+    std::cout << "\n";
+    std::remove("sample_pods.bin");
+  }
+
   void execute()
   {
     std::cout << "\nRecipe 7.02: Reading and writing objects from/to binary files."
@@ -214,5 +702,7 @@ namespace recipe_7_02 {
     test1();
     test2();
     test3();
+    test4();
+    test5();
   }
 }
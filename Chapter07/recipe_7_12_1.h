@@ -0,0 +1,772 @@
+#pragma once
+
+// Reading many files at once with asynchronous I/O.
+
+// The recipes of this chapter access files synchronously, one at a time: the thread
+// issues a read, waits until the data is there, and only then issues the next one. With
+// thousands of small files, the time is dominated by the latency of the individual
+// requests (and the system calls), while the storage device could serve many of them
+// at the same time.
+
+// async_io submits many reads and writes at once and reports their completion through a
+// callback or a future. On Linux, it uses io_uring when the kernel supports it: requests
+// are written into a submission ring shared with the kernel and handed over in batches
+// with a single system call (io_uring_enter), and the results are read from a
+// completion ring by a dedicated thread. Elsewhere, or when io_uring is not available
+// (older kernels, or a seccomp policy that forbids it), a pool of threads performs the
+// requests with pread() and pwrite().
+
+// The io_uring interface is used through the raw system calls, so that no library is
+// needed; liburing wraps the same steps.
+
+#include "recipe_7_01.h"
+#include "recipe_7_12.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace recipe_7_12_1 {
+  enum class io_backend { automatic, io_uring, thread_pool };
+
+  class async_io {
+  public:
+    // The result of a request is the number of bytes transferred, or a negated errno
+    // value on failure.
+    using callback = std::function<void(long)>;
+
+    // At most queue_depth requests are in flight at any time; further requests wait
+    // until earlier ones have completed.
+    explicit async_io(unsigned const queue_depth = 256,
+                      io_backend const backend = io_backend::automatic)
+      : depth(std::max(1u, queue_depth))
+    {
+#if defined(__linux__)
+      if (backend != io_backend::thread_pool) {
+        try {
+          uring = std::make_unique<ring>(depth);
+          depth = std::min(depth, uring->capacity());
+          reaper = std::thread(&async_io::reap, this);
+          return;
+        } catch (std::system_error const&) {
+          uring.reset();
+          if (backend == io_backend::io_uring)
+            throw;
+        }
+      }
+#else
+      if (backend == io_backend::io_uring)
+        throw std::system_error(std::make_error_code(std::errc::not_supported),
+                                "io_uring");
+#endif
+
+      auto const no_of_workers
+        = std::min(depth, std::max(4u, 2 * std::thread::hardware_concurrency()));
+      for (unsigned i = 0; i < no_of_workers; ++i)
+        workers.emplace_back(&async_io::work, this);
+    }
+
+    // Waits for all the requests to complete.
+    ~async_io()
+    {
+      wait();
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        done = true;
+#if defined(__linux__)
+        // The completion thread is blocked in the kernel; a no-op request wakes it up.
+        if (uring) {
+          uring->push(IORING_OP_NOP, -1, nullptr, 0, 0, stop_request);
+          uring->submit();
+        }
+#endif
+      }
+      cv.notify_all();
+
+      if (reaper.joinable())
+        reaper.join();
+      for (auto& t : workers)
+        t.join();
+    }
+
+    async_io(async_io const&) = delete;
+    async_io& operator=(async_io const&) = delete;
+
+    bool uses_io_uring() const noexcept
+    {
+#if defined(__linux__)
+      return uring != nullptr;
+#else
+      return false;
+#endif
+    }
+
+    // Reads up to size bytes at the given offset of the file into buffer. The buffer
+    // must remain valid until the request has completed.
+    void read(int const fd, void* const buffer, size_t const size, long long const offset,
+              callback f)
+    {
+      enqueue(false, fd, buffer, size, offset, std::move(f));
+    }
+
+    void write(int const fd, void const* const buffer, size_t const size,
+               long long const offset, callback f)
+    {
+      enqueue(true, fd, const_cast<void*>(buffer), size, offset, std::move(f));
+    }
+
+    // The requests that return a future are submitted right away (with the requests
+    // queued before them), so that the future becomes ready without a call to submit()
+    // or wait().
+    std::future<long> read(int const fd, void* const buffer, size_t const size,
+                           long long const offset)
+    {
+      auto result = std::make_shared<std::promise<long>>();
+      read(fd, buffer, size, offset, [result](long const r) { result->set_value(r); });
+      submit();
+      return result->get_future();
+    }
+
+    std::future<long> write(int const fd, void const* const buffer, size_t const size,
+                            long long const offset)
+    {
+      auto result = std::make_shared<std::promise<long>>();
+      write(fd, buffer, size, offset, [result](long const r) { result->set_value(r); });
+      submit();
+      return result->get_future();
+    }
+
+    // Hands the queued requests over to the kernel. With io_uring, requests with a
+    // callback are only submitted by submit(), wait(), a request with a future, or when
+    // the submission ring is full, so that a batch costs a single system call; the
+    // thread pool starts them right away.
+    void submit()
+    {
+#if defined(__linux__)
+      std::lock_guard<std::mutex> lock(mutex);
+      if (uring)
+        uring->submit();
+#endif
+    }
+
+    // Submits the queued requests and waits until all of them have completed (and
+    // their callbacks have returned).
+    void wait()
+    {
+      submit();
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return in_flight == 0; });
+    }
+
+  private:
+    // A request is issued in transfers of at most max_transfer bytes (the length of an
+    // io_uring request is 32-bit, and Linux transfers less than 2 GiB per call), and a
+    // short transfer is continued from where it stopped, until the whole size has been
+    // transferred, the end of the file is reached, or an error occurs. An error after a
+    // partial transfer reports the number of bytes transferred.
+    static constexpr size_t max_transfer = size_t{ 1 } << 30;
+
+    struct request {
+      bool write;
+      int fd;
+      void* buffer;
+      size_t size;
+      long long offset;
+      callback f;
+      size_t transferred = 0;
+
+      // Accounts for the result of a transfer; returns true if the request is complete.
+      bool advance(long const result) noexcept
+      {
+        if (result <= 0)
+          return true;
+        transferred += static_cast<size_t>(result);
+        return transferred >= size;
+      }
+
+      long result(long const last) const noexcept
+      {
+        return last < 0 && transferred == 0 ? last : static_cast<long>(transferred);
+      }
+    };
+
+    void enqueue(bool const write, int const fd, void* const buffer, size_t const size,
+                 long long const offset, callback f)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+#if defined(__linux__)
+      // Requests that are queued but not submitted cannot complete, so they must be
+      // submitted before waiting for room.
+      if (uring && in_flight == depth)
+        uring->submit();
+#endif
+      cv.wait(lock, [this] { return in_flight < depth; });
+      ++in_flight;
+
+      // A request that could not be queued is not in flight, or wait() would never
+      // return.
+      try {
+#if defined(__linux__)
+        if (uring) {
+          auto const slot
+            = acquire_slot({ write, fd, buffer, size, offset, std::move(f) });
+          try {
+            push_transfer(slot);
+          } catch (...) {
+            release_slot(slot);
+            throw;
+          }
+          return;
+        }
+#endif
+
+        pending.push_back({ write, fd, buffer, size, offset, std::move(f) });
+      } catch (...) {
+        --in_flight;
+        lock.unlock();
+        cv.notify_all();
+        throw;
+      }
+
+      lock.unlock();
+      cv.notify_all();
+    }
+
+    void finish(unsigned const count)
+    {
+      if (count == 0)
+        return;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight -= count;
+      }
+      cv.notify_all();
+    }
+
+    // The thread pool backend.
+    void work()
+    {
+      while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return done || !pending.empty(); });
+        if (pending.empty())
+          return;
+
+        auto r = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+
+        long result;
+#if defined(__unix__) || defined(__APPLE__)
+        while (true) {
+          auto const buffer = static_cast<char*>(r.buffer) + r.transferred;
+          auto const size = std::min(r.size - r.transferred, max_transfer);
+          auto const offset = static_cast<off_t>(r.offset)
+                              + static_cast<off_t>(r.transferred);
+          auto const transferred = r.write ? ::pwrite(r.fd, buffer, size, offset)
+                                           : ::pread(r.fd, buffer, size, offset);
+          result = transferred < 0 ? -errno : static_cast<long>(transferred);
+          if (result != -EINTR && r.advance(result))
+            break;
+        }
+        result = r.result(result);
+#else
+        result = -static_cast<long>(std::errc::not_supported);
+#endif
+        if (r.f)
+          r.f(result);
+        finish(1);
+      }
+    }
+
+#if defined(__linux__)
+    static constexpr std::uint64_t stop_request = ~std::uint64_t{ 0 };
+
+    // A minimal io_uring: the submission ring, the array of submission queue entries and
+    // the completion ring, all mapped from the kernel. The submission side is protected
+    // by the mutex of async_io; the completion side is only used by the reaper thread.
+    class ring {
+    public:
+      explicit ring(unsigned const entries)
+      {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+          throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+        // The destructor does not run if the constructor throws.
+        try {
+          setup(params);
+        } catch (...) {
+          release();
+          throw;
+        }
+      }
+
+      ~ring()
+      {
+        release();
+      }
+
+      ring(ring const&) = delete;
+      ring& operator=(ring const&) = delete;
+
+      // The number of requests that can be in flight without overflowing the completion
+      // ring.
+      unsigned capacity() const noexcept
+      {
+        return cq_entries;
+      }
+
+      void push(std::uint8_t const opcode, int const file, void* const buffer,
+                size_t const size, long long const offset, std::uint64_t const user_data)
+      {
+        auto tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+          submit();
+
+        auto const index = tail & sq_mask;
+        auto& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<std::uint64_t>(buffer);
+        sqe.len = static_cast<std::uint32_t>(size);
+        sqe.off = static_cast<std::uint64_t>(offset);
+        sqe.user_data = user_data;
+
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted;
+      }
+
+      void submit()
+      {
+        while (unsubmitted > 0) {
+          auto const submitted = enter(unsubmitted, 0, 0);
+          if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+              continue;
+            throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+          }
+          unsubmitted -= static_cast<unsigned>(submitted);
+        }
+      }
+
+      // Blocks until at least one completion is available, then passes all the
+      // available completions to f(user_data, result).
+      template <typename F>
+      void reap(F&& f)
+      {
+        auto head = *cq_head;
+        auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while (head == tail) {
+          enter(0, 1, IORING_ENTER_GETEVENTS);
+          tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        }
+
+        for (; head != tail; ++head) {
+          auto const& cqe = cqes[head & cq_mask];
+          f(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+      }
+
+    private:
+      // Maps the rings shared with the kernel.
+      void setup(io_uring_params const& params)
+      {
+        // IORING_OP_READ and IORING_OP_WRITE arrived in Linux 5.6, together with this
+        // feature flag.
+        if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+          throw std::system_error(std::make_error_code(std::errc::not_supported),
+                                  "io_uring");
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+          sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = map(sq_size, IORING_OFF_SQ_RING);
+        cq_ptr = single_mmap ? sq_ptr : map(cq_size, IORING_OFF_CQ_RING);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+
+        auto const sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+
+        auto const cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        cq_entries = params.cq_entries;
+      }
+
+      void release() noexcept
+      {
+        if (sqes != nullptr)
+          ::munmap(sqes, sqes_size);
+        if (cq_ptr != nullptr && !single_mmap)
+          ::munmap(cq_ptr, cq_size);
+        if (sq_ptr != nullptr)
+          ::munmap(sq_ptr, sq_size);
+        ::close(fd);
+      }
+
+      void* map(size_t const size, off_t const offset)
+      {
+        auto const address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (address == MAP_FAILED)
+          throw std::system_error(errno, std::generic_category(), "mmap");
+        return address;
+      }
+
+      int enter(unsigned const to_submit, unsigned const min_complete,
+                unsigned const flags)
+      {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                          min_complete, flags, nullptr, 0));
+      }
+
+      int fd = -1;
+      bool single_mmap = false;
+      void* sq_ptr = nullptr;
+      void* cq_ptr = nullptr;
+      size_t sq_size = 0;
+      size_t cq_size = 0;
+      size_t sqes_size = 0;
+
+      unsigned* sq_head = nullptr;
+      unsigned* sq_tail = nullptr;
+      unsigned* sq_array = nullptr;
+      unsigned sq_mask = 0;
+      unsigned sq_entries = 0;
+      unsigned unsubmitted = 0;
+      io_uring_sqe* sqes = nullptr;
+
+      unsigned* cq_head = nullptr;
+      unsigned* cq_tail = nullptr;
+      unsigned cq_mask = 0;
+      unsigned cq_entries = 0;
+      io_uring_cqe* cqes = nullptr;
+    };
+
+    // The requests in flight are kept in slots whose index is passed to the kernel as
+    // the user data of their transfers. There is room in free_slots for every slot, so
+    // that releasing one cannot throw.
+    std::uint64_t acquire_slot(request r)
+    {
+      if (free_slots.empty()) {
+        free_slots.reserve(slots.size() + 1);
+        slots.push_back(std::move(r));
+        return slots.size() - 1;
+      }
+
+      auto const slot = free_slots.back();
+      free_slots.pop_back();
+      slots[slot] = std::move(r);
+      return slot;
+    }
+
+    void release_slot(std::uint64_t const slot) noexcept
+    {
+      slots[slot].f = nullptr;
+      free_slots.push_back(slot);
+    }
+
+    // Queues the next transfer of the request in the slot.
+    void push_transfer(std::uint64_t const slot)
+    {
+      auto const& r = slots[slot];
+      uring->push(r.write ? IORING_OP_WRITE : IORING_OP_READ, r.fd,
+                  static_cast<char*>(r.buffer) + r.transferred,
+                  std::min(r.size - r.transferred, max_transfer),
+                  r.offset + static_cast<long long>(r.transferred), slot);
+    }
+
+    // The completion thread of the io_uring backend.
+    void reap()
+    {
+      std::vector<std::pair<std::uint64_t, long>> results;
+      std::vector<std::pair<callback, long>> completed;
+      auto stopped = false;
+
+      while (!stopped) {
+        uring->reap([&](std::uint64_t const user_data, int const result) {
+          if (user_data == stop_request)
+            stopped = true;
+          else
+            results.emplace_back(user_data, result);
+        });
+
+        // The whole batch of completions is handled with one acquisition of the mutex
+        // and one notification. The requests that are not complete yet are continued.
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          auto continued = false;
+          for (auto [slot, result] : results) {
+            auto& r = slots[slot];
+            if (!r.advance(result) || result == -EINTR || result == -EAGAIN) {
+              try {
+                push_transfer(slot);
+                continued = true;
+                continue;
+              } catch (std::system_error const& e) {
+                result = -e.code().value();
+              }
+            }
+
+            completed.emplace_back(std::move(r.f), r.result(result));
+            release_slot(slot);
+          }
+
+          // If this fails, the transfers stay queued until the next submit() or wait().
+          if (continued) {
+            try {
+              uring->submit();
+            } catch (std::system_error const&) {
+            }
+          }
+        }
+
+        for (auto& [f, result] : completed) {
+          if (f)
+            f(result);
+        }
+
+        finish(static_cast<unsigned>(completed.size()));
+        results.clear();
+        completed.clear();
+      }
+    }
+
+    std::unique_ptr<ring> uring;
+    std::vector<request> slots;
+    std::vector<std::uint64_t> free_slots;
+    std::thread reaper;
+#endif
+
+    unsigned depth;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    unsigned in_flight = 0;
+    bool done = false;
+
+    std::deque<request> pending;
+    std::vector<std::thread> workers;
+  };
+
+  // Reads all the files with read_data(), one after the other. Returns the number of
+  // bytes read.
+  size_t read_sequentially(std::vector<fs::path> const& files)
+  {
+    size_t total = 0;
+    std::vector<char> buffer;
+    for (auto const& path : files) {
+      total += recipe_7_01::read_data(path.string().c_str(),
+                                      [&buffer](size_t const size) {
+                                        buffer.resize(size);
+                                        return buffer.data();
+                                      });
+    }
+
+    return total;
+  }
+
+  // Reads all the files through the engine, with up to queue_depth requests in flight.
+  // Files are opened as the window advances, so that the number of open descriptors
+  // stays bounded.
+  size_t read_asynchronously(async_io& io, std::vector<fs::path> const& files,
+                             size_t const window = 256)
+  {
+    std::atomic<size_t> total{ 0 };
+#if defined(__unix__) || defined(__APPLE__)
+    std::vector<std::vector<char>> buffers(std::min(window, files.size()));
+    std::vector<int> descriptors;
+
+    for (size_t first = 0; first < files.size(); first += window) {
+      auto const last = std::min(files.size(), first + window);
+
+      for (auto i = first; i < last; ++i) {
+        auto const fd = ::open(files[i].string().c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0) {
+          if (fd >= 0)
+            ::close(fd);
+          continue;
+        }
+
+        auto& buffer = buffers[i - first];
+        buffer.resize(static_cast<size_t>(info.st_size));
+        descriptors.push_back(fd);
+        io.read(fd, buffer.data(), buffer.size(), 0, [&total](long const result) {
+          if (result > 0)
+            total += static_cast<size_t>(result);
+        });
+      }
+
+      io.wait();
+      for (auto const fd : descriptors)
+        ::close(fd);
+      descriptors.clear();
+    }
+#else
+    (void)io;
+    (void)files;
+    (void)window;
+#endif
+
+    return total;
+  }
+
+  void test_async_write_read()
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    async_io io;
+
+    std::vector<std::string> const contents{ "one", "two two", "three three three" };
+    std::vector<std::string> const names{ "async_1.txt", "async_2.txt", "async_3.txt" };
+    std::vector<int> descriptors;
+
+    for (size_t i = 0; i < names.size(); ++i) {
+      descriptors.push_back(::open(names[i].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+      io.write(descriptors[i], contents[i].data(), contents[i].size(), 0, nullptr);
+    }
+    io.wait();
+
+    std::vector<std::string> inputs(names.size());
+    std::vector<std::future<long>> results;
+    for (size_t i = 0; i < names.size(); ++i) {
+      inputs[i].resize(contents[i].size());
+      results.push_back(io.read(descriptors[i], &inputs[i][0], inputs[i].size(), 0));
+    }
+    io.submit();
+
+    for (size_t i = 0; i < names.size(); ++i) {
+      auto const result = results[i].get();
+      std::cout << names[i] << ": " << result << " bytes, "
+                << (inputs[i] == contents[i] ? "equal." : "not equal.") << std::endl;
+
+      ::close(descriptors[i]);
+      std::remove(names[i].c_str());
+    }
+#endif
+  }
+
+  // Reads a fixed set of generated files (so that the byte count cannot change between
+  // the passes) sequentially and through both backends.
+  void test_async_reads()
+  {
+    size_t const no_of_files = 2000;
+    auto const directory = fs::current_path() / "async_files";
+    fs::create_directories(directory);
+
+    std::mt19937 engine(42);
+    std::uniform_int_distribution<size_t> file_size(0, 64 * 1024);
+    std::vector<char> content(64 * 1024, 'x');
+    for (size_t i = 0; i < no_of_files; ++i) {
+      std::ofstream ofile(directory / ("file_" + std::to_string(i) + ".bin"),
+                          std::ios::binary);
+      ofile.write(content.data(), static_cast<std::streamsize>(file_size(engine)));
+    }
+
+    auto const files
+      = recipe_7_12::find_files(directory, [](fs::path const&) { return true; });
+
+    auto const measure = [](auto&& read) {
+      auto const start = std::chrono::high_resolution_clock::now();
+      auto const bytes = read();
+      auto const end = std::chrono::high_resolution_clock::now();
+      return std::make_pair(
+        bytes, std::chrono::duration<double, std::milli>(end - start).count());
+    };
+
+    // The first pass brings the files into the page cache, so that all the variants
+    // read from memory and only the cost of issuing the requests is compared.
+    auto const expected = read_sequentially(files);
+
+    std::cout << files.size() << " files, " << expected << " bytes\n";
+    std::cout << std::left << std::setw(26) << "method" << std::right << std::setw(10)
+              << "ms" << std::endl;
+
+    auto const report = [expected](char const* const name,
+                                   std::pair<size_t, double> const& result) {
+      assert(result.first == expected);
+      std::cout << std::left << std::setw(26) << name << std::right << std::setw(10)
+                << std::fixed << std::setprecision(1) << result.second
+                << std::defaultfloat << std::setprecision(6) << std::endl;
+    };
+
+    report("sequential read_data", measure([&] { return read_sequentially(files); }));
+
+    {
+      async_io io(256, io_backend::thread_pool);
+      report("thread pool", measure([&] { return read_asynchronously(io, files); }));
+    }
+
+    {
+      async_io io(256);
+      if (io.uses_io_uring())
+        report("io_uring", measure([&] { return read_asynchronously(io, files); }));
+      else
+        std::cout << "io_uring is not available\n";
+    }
+
+    fs::remove_all(directory);
+  }
+
+  void execute()
+  {
+    std::cout << "\nRecipe 7.12.1: Reading and writing files asynchronously."
+              << "\n--------------------------------------------------------\n\n";
+
+    test_async_write_read();
+
+    std::cout << "\nReading a set of generated files:\n";
+    test_async_reads();
+  }
+}
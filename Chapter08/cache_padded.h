@@ -0,0 +1,67 @@
+#pragma once
+
+// Cache-line padding to avoid false sharing.
+
+// Processors move memory between caches in whole cache lines (typically 64 bytes). When
+// two threads repeatedly write to different variables that happen to live on the same
+// cache line, the line bounces between the cores even though the threads never touch
+// each other's data. This is called false sharing, and it can make a parallel reduction
+// slower than the sequential one. A typical example is a std::vector<R> of partial
+// results, one element per thread.
+
+// C++17 provides std::hardware_destructive_interference_size in the <new> header as the
+// minimum offset between two objects to avoid false sharing.
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace conclib {
+#ifdef __cpp_lib_hardware_interference_size
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+  inline constexpr std::size_t cache_line_size = std::hardware_destructive_interference_size;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+  inline constexpr std::size_t cache_line_size = 64;
+#endif
+
+  // A value that occupies (at least) a cache line of its own. An array of cache_padded
+  // objects can be written concurrently from different threads, one element per thread,
+  // without false sharing.
+  template <typename T>
+  struct alignas(cache_line_size) cache_padded {
+    T value{};
+
+    cache_padded() = default;
+
+    explicit cache_padded(T v)
+      : value(std::move(v))
+    {
+    }
+
+    T& operator*() noexcept
+    {
+      return value;
+    }
+
+    T const& operator*() const noexcept
+    {
+      return value;
+    }
+
+    T* operator->() noexcept
+    {
+      return &value;
+    }
+
+    T const* operator->() const noexcept
+    {
+      return &value;
+    }
+  };
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+// Epoch-based memory reclamation.
+
+// A lock-free data structure cannot delete a node as soon as it has unlinked it: another
+// thread may have loaded a pointer to the node just before and still be reading it.
+// Epoch-based reclamation defers the deletion until no thread can hold such a pointer.
+
+// The domain has a global epoch counter. A thread accesses the shared data structure only
+// inside a critical section (a guard returned by pin()), and while it is pinned it
+// announces the global epoch it has observed. An unlinked node is retired: it is put on
+// the garbage list of the retiring thread, tagged with the global epoch at that time.
+// The global epoch is advanced by one only when every pinned thread has observed its
+// current value, so once it has advanced twice past the tag of a node, all the threads
+// that could have seen the node have left their critical sections, and it is deleted.
+
+// Every thread registers with the domain on its first pin() (or with register_thread())
+// and gets a record of its own, on a cache line of its own. The records are never
+// deleted while the domain is in use; the record of a thread that exits is reused by the
+// next thread that registers, and its remaining garbage is handed over to the domain.
+
+// A thread tries to advance the epoch and delete its garbage after every
+// collect_threshold retirements. A thread that is descheduled inside a critical section
+// holds the epoch back meanwhile, so the garbage of the others can still pile up. To
+// bound it, a thread that retires an object outside of a critical section while it has
+// more than max_garbage objects pending waits until the epoch has advanced far enough to
+// delete some of them. Inside a critical section it cannot wait (it would hold the epoch
+// back itself), so data structures should retire after their guard has been released.
+// The bound only holds while no thread stays pinned indefinitely: a thread that blocks
+// inside a critical section stops the reclamation in the whole domain.
+
+// This follows the scheme described in: K. Fraser, Practical Lock-Freedom, 2004.
+
+#include "cache_padded.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace conclib {
+  class epoch_domain {
+    struct record;
+    struct shared_state;
+
+  public:
+    using deleter = void (*)(void*);
+
+    static constexpr std::size_t collect_threshold = 64;
+    static constexpr std::size_t max_garbage = 16 * collect_threshold;
+
+    // A critical section of the calling thread. Guards can be nested; the thread is
+    // unpinned when the outermost guard is destroyed.
+    class guard {
+    public:
+      guard(guard&& other) noexcept : rec(std::exchange(other.rec, nullptr)) {}
+      guard(guard const&) = delete;
+      guard& operator=(guard const&) = delete;
+      guard& operator=(guard&&) = delete;
+
+      ~guard()
+      {
+        if (rec != nullptr && --rec->nesting == 0)
+          rec->epoch.store(0, std::memory_order_release);
+      }
+
+    private:
+      friend class epoch_domain;
+
+      explicit guard(record* rec) : rec(rec) {}
+
+      record* rec;
+    };
+
+    epoch_domain() : state(std::make_shared<shared_state>()) {}
+
+    epoch_domain(epoch_domain const&) = delete;
+    epoch_domain& operator=(epoch_domain const&) = delete;
+
+    // A process-wide domain, created on first use.
+    static epoch_domain& instance()
+    {
+      static epoch_domain domain;
+      return domain;
+    }
+
+    // Registers the calling thread, if it is not registered yet. Registration is
+    // otherwise done by the first pin() of the thread.
+    void register_thread()
+    {
+      local();
+    }
+
+    guard pin()
+    {
+      auto& rec = local();
+      if (rec.nesting++ == 0) {
+        // The announcement must be visible to the other threads before this thread
+        // loads any pointer from the data structure, hence the sequentially consistent
+        // exchange rather than a store.
+        auto const epoch = state->epoch.load(std::memory_order_seq_cst);
+        rec.epoch.exchange(epoch << 1 | 1, std::memory_order_seq_cst);
+      }
+
+      return guard(&rec);
+    }
+
+    // Deletes the object with d(p) when no thread can access it anymore. The object
+    // must already be unreachable for the threads that pin the domain from now on.
+    void retire(void* const p, deleter const d)
+    {
+      auto& rec = local();
+      rec.garbage.push_back({ p, d, state->epoch.load(std::memory_order_seq_cst) });
+      state->pending.fetch_add(1, std::memory_order_relaxed);
+
+      if (++rec.retired_since_collect >= collect_threshold)
+        collect(rec);
+
+      while (rec.nesting == 0 && rec.garbage.size() > max_garbage) {
+        std::this_thread::yield();
+        collect(rec);
+      }
+    }
+
+    template <typename T>
+    void retire(T* const p)
+    {
+      retire(p, [](void* q) { delete static_cast<T*>(q); });
+    }
+
+    // Tries to advance the epoch and deletes the garbage of the calling thread (and the
+    // garbage left by the threads that have exited) that has become safe to delete.
+    void collect()
+    {
+      collect(local());
+    }
+
+    // The number of retired objects that have not been deleted yet.
+    std::size_t pending() const noexcept
+    {
+      return state->pending.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct retired {
+      void* p;
+      deleter d;
+      std::uint64_t epoch;
+    };
+
+    struct alignas(cache_line_size) record {
+      // The observed global epoch shifted left by one, with the lowest bit set while the
+      // thread is pinned; 0 when it is not.
+      std::atomic<std::uint64_t> epoch{ 0 };
+      std::atomic<bool> in_use{ true };
+      record* next = nullptr;
+
+      // Only accessed by the owning thread.
+      unsigned nesting = 0;
+      std::size_t retired_since_collect = 0;
+      std::vector<retired> garbage;
+    };
+
+    // The state outlives the domain object as long as some thread that has used the
+    // domain is alive, because the threads release their records when they exit.
+    struct shared_state {
+      alignas(cache_line_size) std::atomic<std::uint64_t> epoch{ 0 };
+      alignas(cache_line_size) std::atomic<record*> records{ nullptr };
+      std::atomic<std::size_t> pending{ 0 };
+
+      std::mutex mutex;
+      std::vector<retired> orphans;
+
+      ~shared_state()
+      {
+        for (auto const& r : orphans)
+          r.d(r.p);
+
+        auto rec = records.load(std::memory_order_acquire);
+        while (rec != nullptr)
+          delete std::exchange(rec, rec->next);
+      }
+
+      record& acquire_record()
+      {
+        for (auto rec = records.load(std::memory_order_acquire); rec != nullptr;
+             rec = rec->next) {
+          if (!rec->in_use.load(std::memory_order_relaxed)
+              && !rec->in_use.exchange(true, std::memory_order_acquire))
+            return *rec;
+        }
+
+        auto rec = new record;
+        auto head = records.load(std::memory_order_relaxed);
+        do {
+          rec->next = head;
+        } while (!records.compare_exchange_weak(head, rec, std::memory_order_release,
+                                                std::memory_order_relaxed));
+        return *rec;
+      }
+
+      void release_record(record& rec)
+      {
+        if (!rec.garbage.empty()) {
+          std::lock_guard<std::mutex> lock(mutex);
+          orphans.insert(std::end(orphans), std::begin(rec.garbage),
+                         std::end(rec.garbage));
+          rec.garbage.clear();
+        }
+
+        rec.retired_since_collect = 0;
+        rec.epoch.store(0, std::memory_order_relaxed);
+        rec.in_use.store(false, std::memory_order_release);
+      }
+
+      // The epoch advances only when every pinned thread has observed its current
+      // value. Returns the (possibly new) global epoch.
+      std::uint64_t try_advance()
+      {
+        auto current = epoch.load(std::memory_order_seq_cst);
+
+        for (auto rec = records.load(std::memory_order_acquire); rec != nullptr;
+             rec = rec->next) {
+          auto const announced = rec->epoch.load(std::memory_order_seq_cst);
+          if ((announced & 1) != 0 && (announced >> 1) != current)
+            return current;
+        }
+
+        if (epoch.compare_exchange_strong(current, current + 1,
+                                          std::memory_order_seq_cst))
+          return current + 1;
+        return current;
+      }
+
+      // Deletes the objects retired at least two epochs before the given one.
+      void reclaim(std::vector<retired>& garbage, std::uint64_t const current)
+      {
+        auto const safe = std::partition(
+          std::begin(garbage), std::end(garbage),
+          [current](retired const& r) { return r.epoch + 2 > current; });
+
+        auto const count = static_cast<std::size_t>(std::end(garbage) - safe);
+        for (auto it = safe; it != std::end(garbage); ++it)
+          it->d(it->p);
+
+        garbage.erase(safe, std::end(garbage));
+        pending.fetch_sub(count, std::memory_order_relaxed);
+      }
+    };
+
+    // The registrations of a thread, released when the thread exits.
+    struct registrations {
+      std::vector<std::pair<std::shared_ptr<shared_state>, record*>> entries;
+
+      ~registrations()
+      {
+        for (auto& [state, rec] : entries)
+          state->release_record(*rec);
+      }
+    };
+
+    record& local()
+    {
+      thread_local registrations registered;
+      thread_local std::pair<shared_state*, record*> last{ nullptr, nullptr };
+
+      if (last.first == state.get())
+        return *last.second;
+
+      auto entry = std::find_if(
+        std::begin(registered.entries), std::end(registered.entries),
+        [this](auto const& e) { return e.first == state; });
+      if (entry == std::end(registered.entries)) {
+        registered.entries.emplace_back(state, &state->acquire_record());
+        entry = std::prev(std::end(registered.entries));
+      }
+
+      last = { state.get(), entry->second };
+      return *entry->second;
+    }
+
+    void collect(record& rec)
+    {
+      rec.retired_since_collect = 0;
+      auto const current = state->try_advance();
+      state->reclaim(rec.garbage, current);
+
+      std::unique_lock<std::mutex> lock(state->mutex, std::try_to_lock);
+      if (lock.owns_lock() && !state->orphans.empty())
+        state->reclaim(state->orphans, current);
+    }
+
+    std::shared_ptr<shared_state> state;
+  };
+}
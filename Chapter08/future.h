@@ -0,0 +1,390 @@
+#pragma once
+
+// Futures that run on an executor and compose without blocking.
+
+// std::future can only be waited on: to combine the results of several tasks, a thread
+// has to block on each get() in turn. The future below carries the executor it belongs to
+// (a conclib::thread_pool) and supports continuations. then() attaches a function that
+// is submitted to the executor as soon as the value is available, and when_all() and
+// when_any() produce futures that become ready when all or any of their inputs do.
+// A computation can then be expressed as a graph of continuations, and no worker thread
+// ever waits for another one. Only the final consumer calls get().
+
+// The design follows the Concurrency TS (std::experimental::future) and the Boost.Thread
+// futures:
+// https://en.cppreference.com/w/cpp/experimental/concurrency
+// https://www.boost.org/doc/libs/release/doc/html/thread/synchronization.html#thread.synchronization.futures
+
+#include "thread_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace conclib {
+  template <typename T>
+  class future;
+
+  template <typename T>
+  class promise;
+
+  namespace detail {
+    // void results are stored as an empty value.
+    template <typename T>
+    using storage_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    template <typename T>
+    struct shared_state {
+      std::mutex mutex;
+      std::condition_variable ready_cv;
+      bool ready = false;
+      std::optional<storage_t<T>> value;
+      std::exception_ptr error;
+      std::vector<std::function<void()>> continuations;
+
+      template <typename... Args>
+      void set_value(Args&&... args)
+      {
+        complete([&] { value.emplace(std::forward<Args>(args)...); });
+      }
+
+      void set_exception(std::exception_ptr e)
+      {
+        complete([&] { error = e; });
+      }
+
+      // Continuations run on the thread that makes the state ready, or immediately if it
+      // is already ready. They are expected to be short; real work is posted to the
+      // executor by the callers.
+      void on_ready(std::function<void()> k)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!ready) {
+            continuations.push_back(std::move(k));
+            return;
+          }
+        }
+        k();
+      }
+
+    private:
+      template <typename Store>
+      void complete(Store store)
+      {
+        std::vector<std::function<void()>> ks;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (ready)
+            throw std::logic_error("promise already satisfied");
+          store();
+          ready = true;
+          ks.swap(continuations);
+        }
+        ready_cv.notify_all();
+
+        for (auto& k : ks)
+          k();
+      }
+    };
+
+    // Invokes f with the arguments and stores the result (or the exception) in the state.
+    template <typename R, typename F, typename... Args>
+    void fulfil(shared_state<R>& state, F& f, Args&&... args)
+    {
+      try {
+        if constexpr (std::is_void_v<R>) {
+          std::invoke(f, std::forward<Args>(args)...);
+          state.set_value();
+        } else
+          state.set_value(std::invoke(f, std::forward<Args>(args)...));
+      } catch (...) {
+        state.set_exception(std::current_exception());
+      }
+    }
+
+    template <typename F, typename T>
+    struct continuation_result {
+      using type = std::invoke_result_t<F, T>;
+    };
+
+    template <typename F>
+    struct continuation_result<F, void> {
+      using type = std::invoke_result_t<F>;
+    };
+  }
+
+  template <typename T>
+  class future {
+  public:
+    future() = default;
+
+    bool valid() const noexcept
+    {
+      return state != nullptr;
+    }
+
+    bool is_ready() const
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      return state->ready;
+    }
+
+    thread_pool& executor() const noexcept
+    {
+      return *pool;
+    }
+
+    // Blocks the calling thread. Must not be called from a worker of the executor while
+    // the value depends on other tasks of the same executor; use then() instead.
+    void wait() const
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->ready_cv.wait(lock, [this] { return state->ready; });
+    }
+
+    // Waits for the value and moves it out of the future, or rethrows the stored
+    // exception. The future is no longer valid afterwards.
+    T get()
+    {
+      wait();
+      auto s = std::move(state);
+      if (s->error)
+        std::rethrow_exception(s->error);
+      if constexpr (!std::is_void_v<T>)
+        return std::move(*s->value);
+    }
+
+    // Attaches a continuation that receives the value of this future and runs on the
+    // executor once the value is available. If this future holds an exception, the
+    // continuation is skipped and the exception is propagated to the returned future.
+    template <typename F>
+    auto then(F&& f)
+      -> future<typename detail::continuation_result<std::decay_t<F>, T>::type>
+    {
+      using R = typename detail::continuation_result<std::decay_t<F>, T>::type;
+
+      auto next = std::make_shared<detail::shared_state<R>>();
+      auto s = std::move(state);
+      auto p = pool;
+
+      s->on_ready([s, next, p, f = std::forward<F>(f)]() mutable {
+        p->post([s, next, f = std::move(f)]() mutable {
+          if (s->error)
+            next->set_exception(s->error);
+          else if constexpr (std::is_void_v<T>)
+            detail::fulfil(*next, f);
+          else
+            detail::fulfil(*next, f, std::move(*s->value));
+        });
+      });
+
+      return future<R>(std::move(next), p);
+    }
+
+  private:
+    template <typename>
+    friend class future;
+    template <typename>
+    friend class promise;
+    template <typename U>
+    friend future<std::conditional_t<std::is_void_v<U>, void, std::vector<U>>>
+    when_all(std::vector<future<U>> futures);
+    template <typename A, typename B>
+    friend future<std::pair<A, B>> when_all(future<A> a, future<B> b);
+    template <typename U>
+    friend future<std::pair<size_t, U>> when_any(std::vector<future<U>> futures);
+
+    future(std::shared_ptr<detail::shared_state<T>> s, thread_pool* p)
+      : state(std::move(s))
+      , pool(p)
+    {
+    }
+
+    std::shared_ptr<detail::shared_state<T>> state;
+    thread_pool* pool = nullptr;
+  };
+
+  template <typename T>
+  class promise {
+  public:
+    explicit promise(thread_pool& executor = thread_pool::instance())
+      : state(std::make_shared<detail::shared_state<T>>())
+      , pool(&executor)
+    {
+    }
+
+    future<T> get_future()
+    {
+      return future<T>(state, pool);
+    }
+
+    template <typename... Args>
+    void set_value(Args&&... args)
+    {
+      state->set_value(std::forward<Args>(args)...);
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+      state->set_exception(e);
+    }
+
+  private:
+    std::shared_ptr<detail::shared_state<T>> state;
+    thread_pool* pool;
+  };
+
+  // Runs f on the executor and returns a future for its result.
+  template <typename F>
+  auto async(thread_pool& executor, F&& f)
+    -> future<std::invoke_result_t<std::decay_t<F>>>
+  {
+    using R = std::invoke_result_t<std::decay_t<F>>;
+
+    promise<R> p(executor);
+    auto result = p.get_future();
+    executor.post([p, f = std::forward<F>(f)]() mutable {
+      try {
+        if constexpr (std::is_void_v<R>) {
+          f();
+          p.set_value();
+        } else
+          p.set_value(f());
+      } catch (...) {
+        p.set_exception(std::current_exception());
+      }
+    });
+
+    return result;
+  }
+
+  // Becomes ready when all the futures are ready. The values are collected in the order
+  // of the input (there are none for void futures). If any of the inputs fails, the
+  // result holds the first exception.
+  template <typename T>
+  future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>>
+  when_all(std::vector<future<T>> futures)
+  {
+    using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+    struct context {
+      std::atomic<size_t> remaining;
+      std::vector<std::optional<detail::storage_t<T>>> values;
+      std::mutex mutex;
+      std::exception_ptr error;
+      std::shared_ptr<detail::shared_state<R>> result;
+    };
+
+    auto pool = futures.empty() ? &thread_pool::instance() : futures.front().pool;
+    auto ctx = std::make_shared<context>();
+    ctx->remaining = futures.size();
+    ctx->values.resize(futures.size());
+    ctx->result = std::make_shared<detail::shared_state<R>>();
+
+    auto finish = [ctx] {
+      if (ctx->error)
+        ctx->result->set_exception(ctx->error);
+      else if constexpr (std::is_void_v<T>)
+        ctx->result->set_value();
+      else {
+        std::vector<T> values;
+        values.reserve(ctx->values.size());
+        for (auto& v : ctx->values)
+          values.push_back(std::move(*v));
+        ctx->result->set_value(std::move(values));
+      }
+    };
+
+    if (futures.empty())
+      finish();
+
+    for (size_t i = 0; i < futures.size(); ++i) {
+      auto s = std::move(futures[i].state);
+      s->on_ready([ctx, s, i, finish] {
+        if (s->error) {
+          std::lock_guard<std::mutex> lock(ctx->mutex);
+          if (!ctx->error)
+            ctx->error = s->error;
+        } else
+          ctx->values[i] = std::move(s->value);
+
+        if (ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          finish();
+      });
+    }
+
+    return future<R>(ctx->result, pool);
+  }
+
+  // Becomes ready when both futures are ready.
+  template <typename A, typename B>
+  future<std::pair<A, B>> when_all(future<A> a, future<B> b)
+  {
+    struct context {
+      std::atomic<int> remaining{ 2 };
+      std::shared_ptr<detail::shared_state<A>> a;
+      std::shared_ptr<detail::shared_state<B>> b;
+      std::shared_ptr<detail::shared_state<std::pair<A, B>>> result;
+    };
+
+    auto pool = a.pool;
+    auto ctx = std::make_shared<context>();
+    ctx->a = std::move(a.state);
+    ctx->b = std::move(b.state);
+    ctx->result = std::make_shared<detail::shared_state<std::pair<A, B>>>();
+
+    auto k = [ctx] {
+      if (ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+      if (ctx->a->error)
+        ctx->result->set_exception(ctx->a->error);
+      else if (ctx->b->error)
+        ctx->result->set_exception(ctx->b->error);
+      else
+        ctx->result->set_value(std::move(*ctx->a->value), std::move(*ctx->b->value));
+    };
+
+    ctx->a->on_ready(k);
+    ctx->b->on_ready(k);
+
+    return future<std::pair<A, B>>(ctx->result, pool);
+  }
+
+  // Becomes ready when the first of the futures is ready, with the index and the value
+  // (or the exception) of that future. The other futures keep running.
+  template <typename T>
+  future<std::pair<size_t, T>> when_any(std::vector<future<T>> futures)
+  {
+    if (futures.empty())
+      throw std::invalid_argument("when_any() requires at least one future");
+
+    auto pool = futures.front().pool;
+    auto result = std::make_shared<detail::shared_state<std::pair<size_t, T>>>();
+    auto first = std::make_shared<std::atomic<bool>>(false);
+
+    for (size_t i = 0; i < futures.size(); ++i) {
+      auto s = std::move(futures[i].state);
+      s->on_ready([result, first, s, i] {
+        if (first->exchange(true))
+          return;
+
+        if (s->error)
+          result->set_exception(s->error);
+        else
+          result->set_value(i, std::move(*s->value));
+      });
+    }
+
+    return future<std::pair<size_t, T>>(result, pool);
+  }
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+// A lock-contention profiler.
+
+// A profiled_mutex wraps a lockable type (std::mutex by default) and carries a name.
+// It satisfies the same requirements as the wrapped mutex (lock(), try_lock() and
+// unlock()), so it can be used with std::lock_guard, std::unique_lock, std::lock() or
+// recipe_8_03::lock_guard. For every acquisition it records how long the thread waited
+// for the mutex and how long it held it, and whether the acquisition was contended (the
+// mutex was already locked when the thread tried to acquire it).
+
+// Mutexes with the same name share their statistics, so a mutex that is instantiated
+// many times (for instance, one per stripe of a container) shows up as a single entry.
+
+// The uncontended path is kept cheap: the acquisition is first attempted with
+// try_lock(), and only when that fails is the clock read to measure the wait. The clock
+// is the processor's time-stamp counter where available, converted to nanoseconds when
+// the report is produced. Every thread records into its own histograms (log2 buckets
+// of the duration), without any synchronization, and merges them into the profiler when
+// it exits. The report covers the threads that have exited and the calling thread, and
+// whatever is left is printed to std::clog when the program ends.
+
+// Define CONCLIB_LOCK_PROFILING as 0 to compile the instrumentation out: profiled_mutex
+// then contains nothing but the wrapped mutex and the report is empty.
+
+#ifndef CONCLIB_LOCK_PROFILING
+#define CONCLIB_LOCK_PROFILING 1
+#endif
+
+#include <mutex>
+#include <ostream>
+
+#if CONCLIB_LOCK_PROFILING
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+#endif
+
+namespace conclib {
+#if CONCLIB_LOCK_PROFILING
+  // A histogram of durations with one bucket per power of two.
+  struct lock_histogram {
+    static constexpr unsigned buckets = 48;
+
+    std::array<std::uint64_t, buckets> counts{};
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+
+    void add(std::uint64_t const ticks) noexcept
+    {
+      auto const bucket = std::min<unsigned>(std::bit_width(ticks), buckets - 1);
+      ++counts[bucket];
+      total += ticks;
+      max = std::max(max, ticks);
+    }
+
+    void merge(lock_histogram const& other) noexcept
+    {
+      for (unsigned i = 0; i < buckets; ++i)
+        counts[i] += other.counts[i];
+      total += other.total;
+      max = std::max(max, other.max);
+    }
+
+    std::uint64_t count() const noexcept
+    {
+      std::uint64_t result = 0;
+      for (auto const c : counts)
+        result += c;
+      return result;
+    }
+
+    // The upper bound of the bucket that holds the given quantile.
+    std::uint64_t quantile(double const q) const noexcept
+    {
+      auto const rank = static_cast<std::uint64_t>(q * count());
+      std::uint64_t seen = 0;
+      for (unsigned i = 0; i < buckets; ++i) {
+        seen += counts[i];
+        if (seen > rank)
+          return std::min(max, (std::uint64_t{ 1 } << i) - 1);
+      }
+      return max;
+    }
+  };
+
+  struct lock_site_stats {
+    std::uint64_t contended = 0;
+    lock_histogram wait;
+    lock_histogram hold;
+
+    void merge(lock_site_stats const& other) noexcept
+    {
+      contended += other.contended;
+      wait.merge(other.wait);
+      hold.merge(other.hold);
+    }
+  };
+
+  class lock_profiler {
+  public:
+    using site_id = std::size_t;
+
+    static lock_profiler& instance()
+    {
+      static lock_profiler profiler;
+      return profiler;
+    }
+
+    lock_profiler(lock_profiler const&) = delete;
+    lock_profiler& operator=(lock_profiler const&) = delete;
+
+    ~lock_profiler()
+    {
+      if (std::any_of(std::begin(merged), std::end(merged),
+                      [](auto const& s) { return s.wait.count() > 0; }))
+        print(std::clog);
+    }
+
+    static std::uint64_t ticks() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__) \
+  || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+      return __rdtsc();
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+    }
+
+    // Returns the identifier of the statistics for the given name.
+    site_id add_site(std::string_view const name)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto const it = std::find(std::begin(names), std::end(names), name);
+      if (it != std::end(names))
+        return static_cast<site_id>(it - std::begin(names));
+
+      names.emplace_back(name);
+      merged.emplace_back();
+      return names.size() - 1;
+    }
+
+    // The statistics of the calling thread. The reference stays valid until the thread
+    // exits: a mutex keeps it from lock() to unlock(), while other sites may be added.
+    static lock_site_stats& local(site_id const id)
+    {
+      auto& sites = this_thread().sites;
+      while (id >= sites.size())
+        sites.emplace_back();
+      return sites[id];
+    }
+
+    // Prints the statistics of the threads that have exited and of the calling thread.
+    void report(std::ostream& os)
+    {
+      merge(this_thread().sites);
+      std::lock_guard<std::mutex> lock(mutex);
+      print(os);
+    }
+
+    // Discards the statistics of the threads that have exited and of the calling thread.
+    void reset()
+    {
+      auto& sites = this_thread().sites;
+      std::fill(std::begin(sites), std::end(sites), lock_site_stats{});
+      std::lock_guard<std::mutex> lock(mutex);
+      std::fill(std::begin(merged), std::end(merged), lock_site_stats{});
+    }
+
+  private:
+    // A deque, because growing it at the end does not move the existing elements.
+    struct thread_stats {
+      std::deque<lock_site_stats> sites;
+
+      ~thread_stats()
+      {
+        instance().merge(sites);
+      }
+    };
+
+    static thread_stats& this_thread()
+    {
+      thread_local thread_stats stats;
+      return stats;
+    }
+
+    lock_profiler()
+      : start_ticks(ticks()), start_time(std::chrono::steady_clock::now())
+    {
+    }
+
+    // The statistics are cleared in place, since the mutexes that the thread holds
+    // still refer to them.
+    void merge(std::deque<lock_site_stats>& sites)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t i = 0; i < sites.size(); ++i) {
+        merged[i].merge(sites[i]);
+        sites[i] = lock_site_stats{};
+      }
+    }
+
+    double ns_per_tick() const
+    {
+      auto const elapsed_ticks = ticks() - start_ticks;
+      auto const elapsed_ns = std::chrono::duration<double, std::nano>(
+                                std::chrono::steady_clock::now() - start_time)
+                                .count();
+      return elapsed_ticks == 0 ? 1.0 : elapsed_ns / elapsed_ticks;
+    }
+
+    // Durations are printed in nanoseconds; the quantiles are the upper bounds of
+    // their histogram buckets.
+    void print(std::ostream& os) const
+    {
+      auto const scale = ns_per_tick();
+      auto const ns = [scale](double const ticks) {
+        return static_cast<std::uint64_t>(ticks * scale);
+      };
+
+      os << std::left << std::setw(12) << "mutex" << std::right << std::setw(10)
+         << "locks" << std::right << std::setw(11) << "contended" << std::right
+         << std::setw(10) << "wait avg" << std::right << std::setw(10) << "wait p99"
+         << std::right << std::setw(10) << "wait max" << std::right << std::setw(10)
+         << "hold avg" << std::right << std::setw(10) << "hold p99" << std::endl;
+
+      for (std::size_t i = 0; i < merged.size(); ++i) {
+        auto const& s = merged[i];
+        auto const count = s.wait.count();
+        if (count == 0)
+          continue;
+
+        os << std::left << std::setw(12) << names[i] << std::right << std::setw(10)
+           << count << std::right << std::setw(10) << std::fixed << std::setprecision(1)
+           << 100.0 * s.contended / count << '%' << std::defaultfloat
+           << std::setprecision(6) << std::right << std::setw(10)
+           << ns(static_cast<double>(s.wait.total) / count) << std::right
+           << std::setw(10) << ns(s.wait.quantile(0.99)) << std::right << std::setw(10)
+           << ns(s.wait.max) << std::right << std::setw(10)
+           << ns(static_cast<double>(s.hold.total) / count) << std::right
+           << std::setw(10) << ns(s.hold.quantile(0.99)) << std::endl;
+      }
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> names;
+    std::vector<lock_site_stats> merged;
+
+    std::uint64_t const start_ticks;
+    std::chrono::steady_clock::time_point const start_time;
+  };
+
+  template <typename M = std::mutex>
+  class profiled_mutex {
+  public:
+    explicit profiled_mutex(std::string_view const name)
+      : site(lock_profiler::instance().add_site(name))
+    {
+    }
+
+    profiled_mutex(profiled_mutex const&) = delete;
+    profiled_mutex& operator=(profiled_mutex const&) = delete;
+
+    void lock()
+    {
+      if (mtx.try_lock()) {
+        acquired = lock_profiler::ticks();
+        stats = &lock_profiler::local(site);
+        ++stats->wait.counts[0];
+        return;
+      }
+
+      auto const start = lock_profiler::ticks();
+      mtx.lock();
+      acquired = lock_profiler::ticks();
+
+      stats = &lock_profiler::local(site);
+      ++stats->contended;
+      stats->wait.add(acquired - start);
+    }
+
+    bool try_lock()
+    {
+      if (!mtx.try_lock())
+        return false;
+
+      acquired = lock_profiler::ticks();
+      stats = &lock_profiler::local(site);
+      ++stats->wait.counts[0];
+      return true;
+    }
+
+    void unlock()
+    {
+      // The time stamp and the statistics of the owner are read while the mutex is
+      // still held.
+      auto const held = lock_profiler::ticks() - acquired;
+      auto const owner = stats;
+      mtx.unlock();
+      owner->hold.add(held);
+    }
+
+  private:
+    M mtx;
+    lock_profiler::site_id const site;
+
+    // Only accessed by the owner of the mutex.
+    std::uint64_t acquired = 0;
+    lock_site_stats* stats = nullptr;
+  };
+#else
+  class lock_profiler {
+  public:
+    static lock_profiler& instance()
+    {
+      static lock_profiler profiler;
+      return profiler;
+    }
+
+    void report(std::ostream&) {}
+    void reset() {}
+  };
+
+  template <typename M = std::mutex>
+  class profiled_mutex {
+  public:
+    template <typename Name>
+    explicit profiled_mutex(Name const&)
+    {
+    }
+
+    profiled_mutex(profiled_mutex const&) = delete;
+    profiled_mutex& operator=(profiled_mutex const&) = delete;
+
+    void lock()
+    {
+      mtx.lock();
+    }
+
+    bool try_lock()
+    {
+      return mtx.try_lock();
+    }
+
+    void unlock()
+    {
+      mtx.unlock();
+    }
+
+  private:
+    M mtx;
+  };
+#endif
+}
@@ -7,6 +7,10 @@
 #include "recipe_8_07.h"
 #include "recipe_8_08.h"
 #include "recipe_8_09.h"
+#include "recipe_8_09_1.h"
+#include "recipe_8_09_2.h"
+#include "recipe_8_09_3.h"
+#include "recipe_8_09_4.h"
 #include "recipe_8_10.h"
 
 int main()
@@ -20,6 +24,10 @@ int main()
   recipe_8_07::execute();
   recipe_8_08::execute();
   recipe_8_09::execute();
+  recipe_8_09_1::execute();
+  recipe_8_09_2::execute();
+  recipe_8_09_3::execute();
+  recipe_8_09_4::execute();
   recipe_8_10::execute();
 
   return 0;
@@ -0,0 +1,303 @@
+#pragma once
+
+// A bounded multi-producer/multi-consumer lock-free ring buffer.
+
+// The design is Dmitry Vyukov's bounded MPMC queue:
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+// Every slot of the ring carries a sequence number that tells whether the slot is ready
+// to be written (sequence == position) or to be read (sequence == position + 1).
+// Producers and consumers claim positions with a compare-and-swap on their own index and
+// then only touch the slot they claimed, so they never serialize on a common lock.
+// Threads only block (on a condition variable) when the queue is full or empty, and the
+// other side only pays for a notification when somebody is actually waiting.
+
+#include "cache_padded.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace conclib {
+  template <typename T>
+  class mpmc_queue {
+  public:
+    // The capacity is rounded up to a power of two.
+    explicit mpmc_queue(size_t const capacity)
+      : mask(round_up(capacity) - 1)
+      , buffer(new cell[mask + 1])
+    {
+      for (size_t i = 0; i <= mask; ++i)
+        buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    mpmc_queue(mpmc_queue const&) = delete;
+    mpmc_queue& operator=(mpmc_queue const&) = delete;
+
+    size_t capacity() const noexcept
+    {
+      return mask + 1;
+    }
+
+    // Non-blocking operations; they fail when the queue is full or empty.
+    bool try_push(T const& value)
+    {
+      return try_emplace(value);
+    }
+
+    bool try_push(T&& value)
+    {
+      return try_emplace(std::move(value));
+    }
+
+    bool try_pop(T& value)
+    {
+      auto pos = dequeue_pos.load(std::memory_order_relaxed);
+      cell* c;
+
+      while (true) {
+        c = &buffer[pos & mask];
+        auto const seq = c->sequence.load(std::memory_order_acquire);
+        auto const diff
+          = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+
+        if (diff == 0) {
+          if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        } else if (diff < 0)
+          return false;
+        else
+          pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+
+      value = std::move(c->data);
+      c->sequence.store(pos + mask + 1, std::memory_order_release);
+
+      notify(waiting_producers, not_full);
+      return true;
+    }
+
+    // Blocking operations; they wait only while the queue is full or empty.
+    void push(T value)
+    {
+      while (!try_push_spinning(value)) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting_producers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_full.wait(lock, [this] { return !full(); });
+        waiting_producers.fetch_sub(1);
+      }
+    }
+
+    T pop()
+    {
+      T value;
+      while (!try_pop_spinning(value)) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting_consumers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_empty.wait(lock, [this] { return !empty(); });
+        waiting_consumers.fetch_sub(1);
+      }
+
+      return value;
+    }
+
+    // Pushes all the elements of the range, blocking whenever the queue is full. Runs
+    // of free slots are claimed with a single compare-and-swap.
+    template <typename Iter>
+    void push_batch(Iter first, Iter last)
+    {
+      while (first != last) {
+        auto const pushed = try_push_batch(first, last);
+        if (pushed == 0) {
+          push(*first);
+          ++first;
+        } else
+          std::advance(first, pushed);
+      }
+    }
+
+    // Blocks until at least one element is available and then pops up to max_count
+    // elements without further blocking. Returns the number of popped elements.
+    template <typename OutIter>
+    size_t pop_batch(OutIter out, size_t const max_count)
+    {
+      if (max_count == 0)
+        return 0;
+
+      auto count = try_pop_batch(out, max_count);
+      if (count == 0) {
+        *out++ = pop();
+        count = 1 + try_pop_batch(out, max_count - 1);
+      }
+
+      return count;
+    }
+
+  private:
+    struct cell {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+
+    static constexpr int spin_count = 64;
+
+    static size_t round_up(size_t const value)
+    {
+      size_t result = 2;
+      while (result < value)
+        result <<= 1;
+      return result;
+    }
+
+    template <typename U>
+    bool try_emplace(U&& value)
+    {
+      auto pos = enqueue_pos.load(std::memory_order_relaxed);
+      cell* c;
+
+      while (true) {
+        c = &buffer[pos & mask];
+        auto const seq = c->sequence.load(std::memory_order_acquire);
+        auto const diff
+          = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+        if (diff == 0) {
+          if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        } else if (diff < 0)
+          return false;
+        else
+          pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+
+      c->data = std::forward<U>(value);
+      c->sequence.store(pos + 1, std::memory_order_release);
+
+      notify(waiting_consumers, not_empty);
+      return true;
+    }
+
+    // Claims as many consecutive writable slots as possible (at most the length of the
+    // range) with one compare-and-swap. No other producer can claim these slots in the
+    // meantime and consumers can only make more of them writable.
+    template <typename Iter>
+    size_t try_push_batch(Iter first, Iter last)
+    {
+      auto const wanted = static_cast<size_t>(std::distance(first, last));
+      auto pos = enqueue_pos.load(std::memory_order_relaxed);
+      size_t count;
+
+      do {
+        count = 0;
+        while (count < wanted && count <= mask
+               && buffer[(pos + count) & mask].sequence.load(std::memory_order_acquire)
+                    == pos + count)
+          ++count;
+
+        if (count == 0)
+          return 0;
+      } while (
+        !enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed));
+
+      for (size_t i = 0; i < count; ++i, ++first) {
+        auto& c = buffer[(pos + i) & mask];
+        c.data = *first;
+        c.sequence.store(pos + i + 1, std::memory_order_release);
+      }
+
+      notify(waiting_consumers, not_empty);
+      return count;
+    }
+
+    template <typename OutIter>
+    size_t try_pop_batch(OutIter& out, size_t const wanted)
+    {
+      auto pos = dequeue_pos.load(std::memory_order_relaxed);
+      size_t count;
+
+      do {
+        count = 0;
+        while (count < wanted && count <= mask
+               && buffer[(pos + count) & mask].sequence.load(std::memory_order_acquire)
+                    == pos + count + 1)
+          ++count;
+
+        if (count == 0)
+          return 0;
+      } while (
+        !dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed));
+
+      for (size_t i = 0; i < count; ++i) {
+        auto& c = buffer[(pos + i) & mask];
+        *out++ = std::move(c.data);
+        c.sequence.store(pos + i + mask + 1, std::memory_order_release);
+      }
+
+      notify(waiting_producers, not_full);
+      return count;
+    }
+
+    bool try_push_spinning(T& value)
+    {
+      for (int i = 0; i < spin_count; ++i) {
+        if (try_emplace(std::move(value)))
+          return true;
+        std::this_thread::yield();
+      }
+      return false;
+    }
+
+    bool try_pop_spinning(T& value)
+    {
+      for (int i = 0; i < spin_count; ++i) {
+        if (try_pop(value))
+          return true;
+        std::this_thread::yield();
+      }
+      return false;
+    }
+
+    // Approximate emptiness checks used as wait predicates: they look at the slot the
+    // next producer or consumer is going to claim.
+    bool full() const
+    {
+      auto const pos = enqueue_pos.load();
+      return buffer[pos & mask].sequence.load() != pos;
+    }
+
+    bool empty() const
+    {
+      auto const pos = dequeue_pos.load();
+      return buffer[pos & mask].sequence.load() != pos + 1;
+    }
+
+    // The fence pairs with the one on the waiting side: either the waiter sees the new
+    // state in its predicate, or the notifier sees the waiter and wakes it up.
+    void notify(std::atomic<unsigned>& waiters, std::condition_variable& cv)
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiters.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cv.notify_all();
+      }
+    }
+
+    size_t const mask;
+    std::unique_ptr<cell[]> buffer;
+
+    alignas(cache_line_size) std::atomic<size_t> enqueue_pos{ 0 };
+    alignas(cache_line_size) std::atomic<size_t> dequeue_pos{ 0 };
+
+    alignas(cache_line_size) std::atomic<unsigned> waiting_producers{ 0 };
+    std::atomic<unsigned> waiting_consumers{ 0 };
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+  };
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+// A single-shot, allocation-free channel for handing a value to another thread.
+
+// A std::promise/std::future pair allocates a shared state on the heap, which contains
+// (in the common implementations) a mutex and a condition variable. That is a lot of
+// machinery for passing a single value once. oneshot<T> is owned by the caller (on the
+// stack or as a member), stores the value inline, and synchronizes with a single
+// std::atomic<int>. The consumer spins briefly and then blocks with the C++20
+// std::atomic::wait(), which is implemented on top of a futex on Linux and of
+// WaitOnAddress on Windows, so no kernel objects are created up front.
+
+// Unlike std::promise/std::future, the channel can be reused: after get() has consumed
+// the value, the producer may call set_value() again. The caller has to ensure that the
+// oneshot outlives both threads' use of it. Making the channel empty is a release, and
+// the producer's check for it an acquire, so the value is destroyed before the next one
+// is constructed in its place.
+
+// The producer still accesses the channel after the store that makes the value visible:
+// it notifies the waiting consumer. Until it is done, the state carries a notifying flag,
+// and wait(), get() and the destructor do not return before the flag is cleared, so the
+// consumer may destroy the channel as soon as it has the value.
+
+#include "spinlock.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace conclib {
+  template <typename T>
+  class oneshot {
+    enum state_t : int { empty, value_set, exception_set, notifying = 4 };
+
+    alignas(T) unsigned char storage[sizeof(T)];
+    std::exception_ptr error;
+    std::atomic<int> state{ empty };
+
+    T* value_ptr() noexcept
+    {
+      return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    void publish(state_t const s)
+    {
+      state.store(s | notifying, std::memory_order_release);
+      state.notify_one();
+      state.fetch_and(~notifying, std::memory_order_release);
+    }
+
+    // The state, once the producer no longer accesses the channel.
+    int settled() const noexcept
+    {
+      auto s = state.load(std::memory_order_acquire);
+      while ((s & notifying) != 0) {
+        std::this_thread::yield();
+        s = state.load(std::memory_order_acquire);
+      }
+      return s;
+    }
+
+  public:
+    oneshot() = default;
+    oneshot(oneshot const&) = delete;
+    oneshot& operator=(oneshot const&) = delete;
+
+    ~oneshot()
+    {
+      if (settled() == value_set)
+        std::destroy_at(value_ptr());
+    }
+
+    template <typename... Args>
+    void set_value(Args&&... args)
+    {
+      if (state.load(std::memory_order_acquire) != empty)
+        throw std::logic_error("oneshot already holds a value");
+
+      ::new (static_cast<void*>(storage)) T(std::forward<Args>(args)...);
+      publish(value_set);
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+      if (state.load(std::memory_order_acquire) != empty)
+        throw std::logic_error("oneshot already holds a value");
+
+      error = std::move(e);
+      publish(exception_set);
+    }
+
+    bool is_ready() const noexcept
+    {
+      return state.load(std::memory_order_acquire) != empty;
+    }
+
+    void wait() const noexcept
+    {
+      // A short spin catches the producers that are just about to publish; after that
+      // the thread goes to sleep until it is notified. On a single core, spinning only
+      // delays the producer.
+      static int const spins = std::thread::hardware_concurrency() > 1 ? 128 : 0;
+      for (int i = 0; i < spins; ++i) {
+        if (state.load(std::memory_order_acquire) != empty)
+          break;
+        cpu_relax();
+      }
+
+      while (state.load(std::memory_order_acquire) == empty)
+        state.wait(empty, std::memory_order_acquire);
+      settled();
+    }
+
+    // Blocks until the value is available, moves it out, and makes the channel empty
+    // again. Rethrows the exception set by the producer, if any.
+    T get()
+    {
+      wait();
+
+      if (state.load(std::memory_order_relaxed) == exception_set) {
+        auto e = std::move(error);
+        error = nullptr;
+        state.store(empty, std::memory_order_release);
+        std::rethrow_exception(e);
+      }
+
+      T result = std::move(*value_ptr());
+      std::destroy_at(value_ptr());
+      state.store(empty, std::memory_order_release);
+
+      return result;
+    }
+  };
+}
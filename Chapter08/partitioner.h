@@ -0,0 +1,107 @@
+#pragma once
+
+// An adaptive partitioner that picks the number of tasks and the chunk size for a
+// parallel algorithm from the measured cost of the operation.
+
+// A fixed cutoff (such as "run sequentially below 10000 elements") and a fixed number of
+// chunks (one per core) cannot be right for every operation: adding two integers costs
+// less than a nanosecond per element, so splitting 100000 of them across threads costs
+// more than it saves, while an operation that takes microseconds per element is worth
+// parallelizing for a few hundred elements and benefits from more, smaller chunks that
+// idle workers can steal.
+
+// The partitioner runs the operation on a small prefix of the range (the sample is part
+// of the real work, not extra work), measures the time per element, and sizes the chunks
+// so that each of them runs for roughly min_task_time. The measured cost is cached per
+// Key type (typically the type of the callable and of the iterator), so only the first
+// call with a given operation pays for the measurement.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+namespace conclib {
+  struct partition {
+    // The number of elements of the range that were processed while sampling.
+    std::size_t sampled = 0;
+    // The number of tasks to split the rest of the range into; 1 means sequential.
+    std::size_t no_of_tasks = 1;
+    // The number of elements of each task (the last one may be shorter).
+    std::size_t grain = 0;
+  };
+
+  template <typename Key>
+  class adaptive_partitioner {
+    using clock = std::chrono::steady_clock;
+
+    // Below this, the overhead of submitting and joining a task is not negligible.
+    static constexpr double min_task_ns = 50'000;
+    // More tasks than workers let the workers balance uneven chunks by stealing.
+    static constexpr std::size_t tasks_per_worker = 4;
+    // The sample stops when it has run for this long or has covered this fraction of
+    // the range, whichever comes first.
+    static constexpr double sample_ns = 20'000;
+    static constexpr std::size_t sample_fraction = 16;
+
+    // Nanoseconds per element, or 0 if the operation has not been measured yet.
+    inline static std::atomic<double> cost_per_element{ 0 };
+
+  public:
+    // Plans the split of a range of the given size for the given number of workers.
+    // sample(first, count) must process the elements [first, first + count) of the range
+    // (exactly as the sequential algorithm would); it is only invoked if the cost of the
+    // operation is not known yet.
+    template <typename Sample>
+    static partition plan(std::size_t const size, unsigned const workers, Sample&& sample)
+    {
+      partition p;
+      if (size == 0)
+        return p;
+
+      auto cost = cost_per_element.load(std::memory_order_relaxed);
+      if (cost == 0) {
+        auto const limit =
+          std::min(size, std::max<std::size_t>(1, size / sample_fraction));
+        auto elapsed = 0.0;
+        auto count = std::size_t{ 16 };
+
+        while (p.sampled < limit && elapsed < sample_ns) {
+          count = std::min(count, limit - p.sampled);
+
+          auto const start = clock::now();
+          sample(p.sampled, count);
+          elapsed +=
+            std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+          p.sampled += count;
+          count *= 2;
+        }
+
+        if (p.sampled == 0)
+          return p;
+
+        // A measurement of 0 ns would be taken for "not measured".
+        cost = std::max(elapsed / p.sampled, 0.01);
+        cost_per_element.store(cost, std::memory_order_relaxed);
+      }
+
+      auto const remaining = size - p.sampled;
+      auto const total_ns = cost * remaining;
+      auto const max_tasks = static_cast<std::size_t>(total_ns / min_task_ns);
+
+      p.no_of_tasks = workers > 1 ? std::min(max_tasks, workers * tasks_per_worker) : 1;
+      if (p.no_of_tasks < 2)
+        p.no_of_tasks = 1;
+      p.grain = remaining == 0 ? 0 : (remaining + p.no_of_tasks - 1) / p.no_of_tasks;
+
+      return p;
+    }
+
+    // Forgets the measured cost, for operations whose cost depends on the data.
+    static void reset() noexcept
+    {
+      cost_per_element.store(0, std::memory_order_relaxed);
+    }
+  };
+}
@@ -14,10 +14,16 @@
 // concurrently on a hardware thread too. The C++ library provides support for working
 // with software threads.
 
+#include "thread_pool.h"
+#include "timer_wheel.h"
+#include <atomic>
+#include <cassert>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <random>
 #include <string>
+#include <vector>
 // A thread of execution is represented by the thread class available in the std namespace
 // in the <thread> header. Additional thread utilities are available in the same header
 // but in the std::this_thread namespace.
@@ -96,6 +102,97 @@ namespace recipe_8_01 {
     } while (std::chrono::system_clock::now() < then);
   }
 
+  // Measures the throughput of starting, cancelling and firing a large number of timers
+  // on a timer wheel, which is driven manually, tick by tick, with a fixed start time.
+  void test_timer_wheel()
+  {
+    using namespace std::chrono;
+    using clock = conclib::timer_wheel::clock;
+
+    size_t const no_of_timers = 1000000;
+    std::mt19937 engine(42);
+    std::uniform_int_distribution<> far(1, 600000);
+    std::uniform_int_distribution<> near(1, 1000);
+
+    auto const report = [](char const* operation, size_t const count,
+                           clock::duration const elapsed) {
+      auto const ms = duration<double, std::milli>(elapsed).count();
+      std::cout << std::left << std::setw(10) << operation << std::right << std::setw(10)
+                << count << std::right << std::setw(10) << std::fixed
+                << std::setprecision(1) << ms << std::right << std::setw(10)
+                << count / ms / 1000 << std::defaultfloat << std::setprecision(6)
+                << std::endl;
+    };
+
+    std::cout << std::left << std::setw(10) << "operation" << std::right << std::setw(10)
+              << "timers" << std::right << std::setw(10) << "ms" << std::right
+              << std::setw(10) << "Mops/s" << std::endl;
+
+    auto const start = clock::now();
+    std::vector<conclib::timer_wheel::timer_id> ids(no_of_timers);
+    size_t fired = 0;
+
+    {
+      conclib::timer_wheel wheel(1ms, start);
+
+      // Deadlines up to 10 minutes away, spread over all the levels of the wheel.
+      auto t0 = clock::now();
+      for (auto& id : ids)
+        id = wheel.schedule_at(start + milliseconds(far(engine)), [&fired] { ++fired; });
+      report("insert", no_of_timers, clock::now() - t0);
+
+      t0 = clock::now();
+      size_t cancelled = 0;
+      for (auto const& id : ids)
+        cancelled += wheel.cancel(id);
+      report("cancel", no_of_timers, clock::now() - t0);
+
+      // Every timer was cancelled before its deadline, so none of them may fire.
+      assert(cancelled == no_of_timers && wheel.size() == 0);
+      wheel.advance(start + milliseconds(600000), [](auto&& f) { f(); });
+      assert(fired == 0);
+    }
+
+    {
+      conclib::timer_wheel wheel(1ms, start);
+      for (size_t i = 0; i < no_of_timers; ++i)
+        wheel.schedule_at(start + milliseconds(near(engine)), [&fired] { ++fired; });
+
+      auto const t0 = clock::now();
+      for (int tick = 1; tick <= 1000; ++tick)
+        wheel.advance(start + milliseconds(tick), [](auto&& f) { f(); });
+      report("fire", fired, clock::now() - t0);
+
+      // Every timer fires exactly once.
+      assert(fired == no_of_timers && wheel.size() == 0);
+    }
+  }
+
+  // The timers of a timer_service are all served by a single thread, which hands the
+  // expired callbacks to a thread pool.
+  void test_timer_service()
+  {
+    using namespace std::chrono_literals;
+
+    std::atomic<int> delayed{ 0 };
+    std::atomic<int> periodic{ 0 };
+
+    {
+      conclib::thread_pool pool(2);
+      conclib::timer_service timers(pool);
+      for (int i = 0; i < 100000; ++i)
+        timers.schedule_after(std::chrono::milliseconds(1 + i % 100), [&] { ++delayed; });
+
+      auto const id = timers.schedule_every(20ms, [&] { ++periodic; });
+
+      std::this_thread::sleep_for(110ms);
+      timers.cancel(id);
+    }
+
+    std::cout << delayed << " delayed callbacks and " << periodic
+              << " periodic callbacks served by one timer thread" << std::endl;
+  }
+
   void execute()
   {
     std::cout << "Recipe 8.01: Working with threads.\n"
@@ -208,5 +305,13 @@ namespace recipe_8_01 {
 
       print_time();
     }
+
+    {
+      std::cout << "\nDelays and periodic callbacks on a timer wheel instead of sleeping "
+                   "threads:\n";
+
+      test_timer_wheel();
+      test_timer_service();
+    }
   }
 }
@@ -1,10 +1,19 @@
 #pragma once
 
+#include "lock_profiler.h"
 #include <algorithm>
+#include <array>
 #include <chrono>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace recipe_8_03 {
@@ -136,6 +145,295 @@ namespace recipe_8_03 {
     std::cout << std::endl;
   }
 
+  // container<T> uses a single std::mutex, so lookups exclude each other even though they
+  // never modify the data. With a std::shared_mutex, any number of readers can hold a
+  // shared lock (std::shared_lock) at the same time, while writers still take an
+  // exclusive lock (std::unique_lock or std::lock_guard).
+  template <typename T>
+  class shared_container {
+    mutable std::shared_mutex mutex;
+    std::vector<T> data;
+
+  public:
+    void add(T const value)
+    {
+      std::lock_guard<std::shared_mutex> lock(mutex);
+      data.push_back(value);
+    }
+
+    bool contains(T const& value) const
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      return std::find(data.begin(), data.end(), value) != data.end();
+    }
+
+    template <typename U>
+    friend void move_between(shared_container<U>& c1, shared_container<U>& c2,
+                             U const value);
+  };
+
+  template <typename T>
+  void move_between(shared_container<T>& c1, shared_container<T>& c2, T const value)
+  {
+    std::lock(c1.mutex, c2.mutex);
+    std::lock_guard<std::shared_mutex> l1(c1.mutex, std::adopt_lock);
+    std::lock_guard<std::shared_mutex> l2(c2.mutex, std::adopt_lock);
+
+    c1.data.erase(std::remove(c1.data.begin(), c1.data.end(), value), c1.data.end());
+    c2.data.push_back(value);
+  }
+
+  // A hash-sharded container splits the data into N stripes by the hash of the value.
+  // Each stripe has its own lock, so operations on different stripes do not contend at
+  // all, and every operation only scans the elements of one stripe.
+  template <typename T, size_t N = 16, typename Hash = std::hash<T>>
+  class sharded_container {
+    struct stripe {
+      mutable std::shared_mutex mutex;
+      std::vector<T> data;
+    };
+
+    std::array<stripe, N> stripes;
+
+    stripe& stripe_for(T const& value)
+    {
+      return stripes[Hash{}(value) % N];
+    }
+
+    stripe const& stripe_for(T const& value) const
+    {
+      return stripes[Hash{}(value) % N];
+    }
+
+  public:
+    void add(T const value)
+    {
+      auto& s = stripe_for(value);
+      std::lock_guard<std::shared_mutex> lock(s.mutex);
+      s.data.push_back(value);
+    }
+
+    bool contains(T const& value) const
+    {
+      auto const& s = stripe_for(value);
+      std::shared_lock<std::shared_mutex> lock(s.mutex);
+      return std::find(s.data.begin(), s.data.end(), value) != s.data.end();
+    }
+
+    template <typename U, size_t M, typename H>
+    friend void move_between(sharded_container<U, M, H>& c1,
+                             sharded_container<U, M, H>& c2, U const value);
+  };
+
+  template <typename T, size_t N, typename Hash>
+  void move_between(sharded_container<T, N, Hash>& c1, sharded_container<T, N, Hash>& c2,
+                    T const value)
+  {
+    // Only the two stripes that can hold the value are locked. Locks are always taken in
+    // the order of their addresses, so two threads that move values in opposite
+    // directions cannot deadlock, and moving within the same container locks the stripe
+    // only once.
+    auto& s1 = c1.stripe_for(value);
+    auto& s2 = c2.stripe_for(value);
+
+    auto first = &s1.mutex;
+    auto second = &s2.mutex;
+    if (std::less<std::shared_mutex*>{}(second, first))
+      std::swap(first, second);
+
+    std::unique_lock<std::shared_mutex> l1(*first);
+    std::unique_lock<std::shared_mutex> l2;
+    if (second != first)
+      l2 = std::unique_lock<std::shared_mutex>(*second);
+
+    s1.data.erase(std::remove(s1.data.begin(), s1.data.end(), value), s1.data.end());
+    s2.data.push_back(value);
+  }
+
+  // Runs a mix of lookups and moves between two containers from several threads. The
+  // lookup and the move are supplied by the caller, so that the same load can be applied
+  // to every kind of container.
+  template <typename Lookup, typename Move>
+  std::chrono::microseconds run_mixed_load(int const no_of_threads, int const operations,
+                                           int const read_percent, int const no_of_values,
+                                           Lookup lookup, Move move)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < no_of_threads; ++i) {
+      threads.emplace_back([=]() {
+        auto generator = std::mt19937{ static_cast<unsigned>(i) };
+        auto dvalue = std::uniform_int_distribution<>{ 0, no_of_values - 1 };
+        auto dpercent = std::uniform_int_distribution<>{ 0, 99 };
+
+        for (int j = 0; j < operations; ++j) {
+          auto const value = dvalue(generator);
+          if (dpercent(generator) < read_percent)
+            lookup(value);
+          else
+            move(value, j % 2 == 0);
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  }
+
+  void test_concurrent_containers()
+  {
+    int const no_of_threads = 4;
+    int const operations = 20000;
+    int const no_of_values = 1000;
+
+    std::cout << "\nMixed lookups and moves, " << no_of_threads << " threads x "
+              << operations << " operations (us):\n";
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "reads %"
+              << std::right << std::setw(10) << "mutex" << std::right << std::setw(10)
+              << "shared" << std::right << std::setw(10) << "sharded" << std::endl;
+
+    for (int read_percent : { 50, 90, 99 }) {
+      container<int> m1, m2;
+      shared_container<int> r1, r2;
+      sharded_container<int> h1, h2;
+      for (int i = 0; i < no_of_values; ++i) {
+        m1.data.push_back(i);
+        r1.add(i);
+        h1.add(i);
+      }
+
+      auto tm = run_mixed_load(
+        no_of_threads, operations, read_percent, no_of_values,
+        [&](int const value) {
+          for (auto c : { &m1, &m2 }) {
+            std::lock_guard<std::mutex> lock(c->mutex);
+            if (std::find(c->data.begin(), c->data.end(), value) != c->data.end())
+              break;
+          }
+        },
+        [&](int const value, bool const forward) {
+          if (forward)
+            move_between(m1, m2, value);
+          else
+            move_between(m2, m1, value);
+        });
+
+      auto tr = run_mixed_load(
+        no_of_threads, operations, read_percent, no_of_values,
+        [&](int const value) { return r1.contains(value) || r2.contains(value); },
+        [&](int const value, bool const forward) {
+          if (forward)
+            move_between(r1, r2, value);
+          else
+            move_between(r2, r1, value);
+        });
+
+      auto th = run_mixed_load(
+        no_of_threads, operations, read_percent, no_of_values,
+        [&](int const value) { return h1.contains(value) || h2.contains(value); },
+        [&](int const value, bool const forward) {
+          if (forward)
+            move_between(h1, h2, value);
+          else
+            move_between(h2, h1, value);
+        });
+
+      std::cout << std::right << std::setw(8) << read_percent << std::right
+                << std::setw(10) << tm.count() << std::right << std::setw(10)
+                << tr.count() << std::right << std::setw(10) << th.count() << std::endl;
+    }
+  }
+
+  // To find out which mutex is hot, replace it with a conclib::profiled_mutex, which
+  // records the wait and hold times of every acquisition under the name of the mutex.
+  // The report is printed on demand with conclib::lock_profiler, and at program exit.
+  void test_lock_profiler()
+  {
+    int const no_of_threads = 4;
+    int const operations = 50000;
+    size_t const no_of_stripes = 16;
+
+    {
+      int const iterations = 1000000;
+      std::mutex plain;
+      conclib::profiled_mutex<> profiled("overhead");
+
+      auto const measure = [iterations](auto& mtx) {
+        auto const start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; ++i)
+          lock_guard<std::remove_reference_t<decltype(mtx)>> lock(mtx);
+        auto const end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+      };
+
+      auto const tp = measure(plain);
+      auto const tq = measure(profiled);
+      std::cout << "\nUncontended lock and unlock: std::mutex " << std::fixed
+                << std::setprecision(1) << tp << " ns, profiled_mutex " << tq << " ns"
+                << std::defaultfloat << std::setprecision(6) << std::endl;
+
+      conclib::lock_profiler::instance().reset();
+    }
+
+    // Every operation updates a shared counter under a single mutex, and then updates
+    // one of several stripes, each with its own mutex.
+    conclib::profiled_mutex<> counter_mutex("counter");
+    std::vector<std::unique_ptr<conclib::profiled_mutex<>>> stripe_mutexes;
+    for (size_t i = 0; i < no_of_stripes; ++i)
+      stripe_mutexes.push_back(std::make_unique<conclib::profiled_mutex<>>("stripe"));
+
+    long long counter = 0;
+    std::vector<std::vector<int>> stripes(no_of_stripes);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < no_of_threads; ++i) {
+      threads.emplace_back([&, i]() {
+        auto generator = std::mt19937{ static_cast<unsigned>(i) };
+        auto dstripe = std::uniform_int_distribution<size_t>{ 0, no_of_stripes - 1 };
+
+        for (int j = 0; j < operations; ++j) {
+          {
+            lock_guard<conclib::profiled_mutex<>> lock(counter_mutex);
+            ++counter;
+          }
+
+          auto const k = dstripe(generator);
+          lock_guard<conclib::profiled_mutex<>> lock(*stripe_mutexes[k]);
+          stripes[k].push_back(j);
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    std::cout << "\nLock profile of " << no_of_threads << " threads x " << operations
+              << " operations:\n";
+    conclib::lock_profiler::instance().report(std::cout);
+    conclib::lock_profiler::instance().reset();
+
+    // Mutexes first locked while another one is held add sites to the statistics of
+    // the thread, and the profile can be reported while a mutex is held.
+    {
+      conclib::profiled_mutex<> outer("outer");
+      lock_guard<conclib::profiled_mutex<>> lock_outer(outer);
+      for (int i = 0; i < 8; ++i) {
+        conclib::profiled_mutex<> inner("inner " + std::to_string(i));
+        lock_guard<conclib::profiled_mutex<>> lock_inner(inner);
+      }
+
+      std::cout << "\nLock profile of nested locks:\n";
+      conclib::lock_profiler::instance().report(std::cout);
+      conclib::lock_profiler::instance().reset();
+    }
+    conclib::lock_profiler::instance().reset();
+  }
+
   void execute()
   {
     std::cout << "\nRecipe 8.03: Synchronizing access to shared data with mutexes and locks."
@@ -193,5 +491,8 @@ namespace recipe_8_03 {
       print_container(c1);
       print_container(c2);
     }
+
+    test_concurrent_containers();
+    test_lock_profiler();
   }
 }
@@ -11,10 +11,17 @@
 // blocked until the condition variable is signaled or until a timeout or a spurious
 // wakeup occurs.
 
+#include "mpmc_queue.h"
+#include "spsc_queue.h"
 #include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <iomanip>
 #include <iostream>
 #include <mutex>
+#include <numeric>
 #include <queue>
 #include <random>
 #include <thread>
@@ -99,6 +106,270 @@ namespace recipe_8_05 {
     }
   }
 
+  // The design above, reduced to its core for benchmarking: an unbounded std::queue
+  // guarded by a single mutex, with a condition variable to wait for new items.
+  template <typename T>
+  class locked_queue {
+    std::mutex mutex;
+    std::condition_variable queuecheck;
+    std::queue<T> buffer;
+
+  public:
+    void push(T const value)
+    {
+      {
+        std::lock_guard<std::mutex> locker(mutex);
+        buffer.push(value);
+      }
+      queuecheck.notify_one();
+    }
+
+    T pop()
+    {
+      std::unique_lock<std::mutex> locker(mutex);
+      queuecheck.wait(locker, [this]() { return !buffer.empty(); });
+      auto value = buffer.front();
+      buffer.pop();
+      return value;
+    }
+  };
+
+  // Runs the producers and consumers and returns the throughput in millions of items per
+  // second. Every producer sends the values 1..items_per_producer; once all of them are
+  // done, one end marker (-1) per consumer is sent.
+  template <typename Produce, typename Consume, typename Stop>
+  double measure_throughput(int const producers, int const consumers,
+                            int const items_per_producer, Produce produce,
+                            Consume consume, Stop stop)
+  {
+    std::atomic<long long> total{ 0 };
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> consumer_threads;
+    for (int i = 0; i < consumers; ++i)
+      consumer_threads.emplace_back([&] { total += consume(); });
+
+    std::vector<std::thread> producer_threads;
+    for (int i = 0; i < producers; ++i)
+      producer_threads.emplace_back([&] { produce(items_per_producer); });
+
+    for (auto& t : producer_threads)
+      t.join();
+
+    stop(consumers);
+
+    for (auto& t : consumer_threads)
+      t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    auto const n = static_cast<long long>(items_per_producer);
+    assert(total == producers * n * (n + 1) / 2);
+
+    return producers * n / std::chrono::duration<double, std::micro>(end - start).count();
+  }
+
+  void test_queue_throughput()
+  {
+    int const items_per_producer = 200000;
+    int const batch_size = 64;
+    std::vector<std::pair<int, int>> configurations{ { 1, 1 }, { 2, 1 }, { 1, 2 },
+                                                     { 2, 2 }, { 4, 4 }, { 8, 1 } };
+
+    std::cout << "\nThroughput in millions of items per second:\n";
+    std::cout << std::right << std::setw(6) << std::setfill(' ') << "prod" << std::right
+              << std::setw(6) << "cons" << std::right << std::setw(10) << "mutex"
+              << std::right << std::setw(10) << "mpmc" << std::right << std::setw(10)
+              << "mpmc b" << std::endl;
+
+    for (auto const& [producers, consumers] : configurations) {
+      locked_queue<int> lq;
+      auto tlq = measure_throughput(
+        producers, consumers, items_per_producer,
+        [&](int const count) {
+          for (int i = 1; i <= count; ++i)
+            lq.push(i);
+        },
+        [&] {
+          long long sum = 0;
+          for (int value; (value = lq.pop()) != -1;)
+            sum += value;
+          return sum;
+        },
+        [&](int const count) {
+          for (int i = 0; i < count; ++i)
+            lq.push(-1);
+        });
+
+      conclib::mpmc_queue<int> mq(1024);
+      auto tmq = measure_throughput(
+        producers, consumers, items_per_producer,
+        [&](int const count) {
+          for (int i = 1; i <= count; ++i)
+            mq.push(i);
+        },
+        [&] {
+          long long sum = 0;
+          for (int value; (value = mq.pop()) != -1;)
+            sum += value;
+          return sum;
+        },
+        [&](int const count) {
+          for (int i = 0; i < count; ++i)
+            mq.push(-1);
+        });
+
+      conclib::mpmc_queue<int> bq(1024);
+      auto tbq = measure_throughput(
+        producers, consumers, items_per_producer,
+        [&](int const count) {
+          std::array<int, batch_size> batch;
+          for (int i = 1; i <= count; i += batch_size) {
+            auto const n = std::min(batch_size, count - i + 1);
+            std::iota(std::begin(batch), std::begin(batch) + n, i);
+            bq.push_batch(std::begin(batch), std::begin(batch) + n);
+          }
+        },
+        [&] {
+          long long sum = 0;
+          std::array<int, batch_size> batch;
+          while (true) {
+            auto const n = bq.pop_batch(std::begin(batch), batch.size());
+            auto const last = std::begin(batch) + n;
+            auto const marker = std::find(std::begin(batch), last, -1);
+            sum = std::accumulate(std::begin(batch), marker, sum);
+            if (marker != last) {
+              // All the items after an end marker are end markers as well; hand the
+              // surplus back to the other consumers.
+              for (auto it = std::next(marker); it != last; ++it)
+                bq.push(-1);
+              return sum;
+            }
+          }
+        },
+        [&](int const count) {
+          for (int i = 0; i < count; ++i)
+            bq.push(-1);
+        });
+
+      std::cout << std::right << std::setw(6) << producers << std::right << std::setw(6)
+                << consumers << std::fixed << std::setprecision(2) << std::right
+                << std::setw(10) << tlq << std::right << std::setw(10) << tmq << std::right
+                << std::setw(10) << tbq << std::endl;
+    }
+
+    std::cout << std::defaultfloat << std::setprecision(6);
+  }
+
+  // Sends a value back and forth between two threads through a pair of queues and
+  // returns the average duration of a round trip in nanoseconds.
+  template <typename Queue>
+  double round_trip(Queue& there, Queue& back, int const rounds)
+  {
+    std::thread echo([&] {
+      for (int i = 0; i < rounds; ++i)
+        back.push(there.pop());
+    });
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      there.push(i);
+      [[maybe_unused]] auto const value = back.pop();
+      assert(value == i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    echo.join();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+  }
+
+  // Compares the queues on a single producer and a single consumer: the latency of a
+  // round trip (ping-pong), and the throughput of a stream of items.
+  void test_spsc_queue()
+  {
+    int const rounds = 20000;
+    int const items = 2000000;
+    int const batch_size = 64;
+
+    std::cout << "\nSingle producer, single consumer:\n";
+    std::cout << std::left << std::setw(10) << std::setfill(' ') << "queue" << std::right
+              << std::setw(14) << "round trip ns" << std::right << std::setw(14)
+              << "Mitems/s" << std::right << std::setw(16) << "batch Mitems/s"
+              << std::endl;
+
+    auto const stream = [&](auto& q) {
+      return measure_throughput(
+        1, 1, items,
+        [&](int const count) {
+          for (int i = 1; i <= count; ++i)
+            q.push(i);
+        },
+        [&] {
+          long long sum = 0;
+          for (int value; (value = q.pop()) != -1;)
+            sum += value;
+          return sum;
+        },
+        [&](int) { q.push(-1); });
+    };
+
+    auto const stream_batched = [&](auto& q) {
+      return measure_throughput(
+        1, 1, items,
+        [&](int const count) {
+          std::array<int, batch_size> batch;
+          for (int i = 1; i <= count; i += batch_size) {
+            auto const n = std::min(batch_size, count - i + 1);
+            std::iota(std::begin(batch), std::begin(batch) + n, i);
+            q.push_batch(std::begin(batch), std::begin(batch) + n);
+          }
+        },
+        [&] {
+          long long sum = 0;
+          std::array<int, batch_size> batch;
+          while (true) {
+            auto const n = q.pop_batch(std::begin(batch), batch.size());
+            auto const last = std::begin(batch) + n;
+            auto const marker = std::find(std::begin(batch), last, -1);
+            sum = std::accumulate(std::begin(batch), marker, sum);
+            if (marker != last)
+              return sum;
+          }
+        },
+        [&](int) { q.push(-1); });
+    };
+
+    auto const report = [](char const* name, double const latency,
+                           double const throughput, double const batched) {
+      std::cout << std::left << std::setw(10) << name << std::fixed
+                << std::setprecision(0) << std::right << std::setw(14) << latency
+                << std::setprecision(2) << std::right << std::setw(14) << throughput
+                << std::right << std::setw(16);
+      if (batched > 0)
+        std::cout << batched;
+      else
+        std::cout << "-";
+      std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+    };
+
+    {
+      locked_queue<int> there, back, q;
+      report("mutex", round_trip(there, back, rounds), stream(q), 0);
+    }
+
+    {
+      conclib::mpmc_queue<int> there(1024), back(1024), q(1024), bq(1024);
+      report("mpmc", round_trip(there, back, rounds), stream(q), stream_batched(bq));
+    }
+
+    {
+      conclib::spsc_queue<int> there(1024), back(1024), q(1024), bq(1024);
+      report("spsc", round_trip(there, back, rounds), stream(q), stream_batched(bq));
+    }
+  }
+
   void execute()
   {
     std::cout << "\nRecipe 8.05: Sending notifications between threads."
@@ -134,5 +405,8 @@ namespace recipe_8_05 {
     consumerthread.join();
 
     std::cout << "done producing and consuming" << std::endl;
+
+    test_queue_throughput();
+    test_spsc_queue();
   }
 }
@@ -10,10 +10,18 @@
 // promise is an asynchronous provider of the result and has an associated future that
 // represents an asynchronous return object.
 
+#include "oneshot.h"
+#include <cassert>
+#include <chrono>
 #include <future>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 
 namespace recipe_8_06 {
   std::mutex g_mutex;
@@ -47,6 +55,152 @@ namespace recipe_8_06 {
     std::cout << value << std::endl;
   }
 
+  template <typename F>
+  double nanoseconds_per_iteration(int const iterations, F&& f)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  }
+
+  // Sends a value back and forth between two threads: the main thread sends i on one
+  // channel and the other thread answers with i + 1 on a second channel. Every handoff
+  // has to wake up the other thread, so this measures the latency of the handoff.
+  void test_handoff_latency()
+  {
+    int const iterations = 20000;
+
+    // Creating a channel, setting a value and getting it, all on the same thread. For the
+    // std pair this includes the allocation of the shared state.
+    auto const tstd_local = nanoseconds_per_iteration(iterations, [] {
+      for (int i = 0; i < iterations; ++i) {
+        std::promise<int> p;
+        auto f = p.get_future();
+        p.set_value(i);
+        [[maybe_unused]] auto value = f.get();
+        assert(value == i);
+      }
+    });
+
+    auto const tone_local = nanoseconds_per_iteration(iterations, [] {
+      for (int i = 0; i < iterations; ++i) {
+        conclib::oneshot<int> channel;
+        channel.set_value(i);
+        [[maybe_unused]] auto value = channel.get();
+        assert(value == i);
+      }
+    });
+
+    // Ping-pong between two threads. The std channels are created up front (a promise
+    // can only be satisfied once), so only the handoffs are timed.
+    auto const tstd_pingpong = [] {
+      std::vector<std::promise<int>> pings(iterations), pongs(iterations);
+      std::vector<std::future<int>> ping_futures, pong_futures;
+      for (int i = 0; i < iterations; ++i) {
+        ping_futures.push_back(pings[i].get_future());
+        pong_futures.push_back(pongs[i].get_future());
+      }
+
+      return nanoseconds_per_iteration(iterations * 2, [&] {
+        std::thread t([&] {
+          for (int i = 0; i < iterations; ++i)
+            pongs[i].set_value(ping_futures[i].get() + 1);
+        });
+
+        for (int i = 0; i < iterations; ++i) {
+          pings[i].set_value(i);
+          [[maybe_unused]] auto value = pong_futures[i].get();
+          assert(value == i + 1);
+        }
+
+        t.join();
+      });
+    }();
+
+    auto const tone_pingpong = [] {
+      conclib::oneshot<int> ping, pong;
+
+      return nanoseconds_per_iteration(iterations * 2, [&] {
+        std::thread t([&] {
+          for (int i = 0; i < iterations; ++i)
+            pong.set_value(ping.get() + 1);
+        });
+
+        for (int i = 0; i < iterations; ++i) {
+          ping.set_value(i);
+          [[maybe_unused]] auto value = pong.get();
+          assert(value == i + 1);
+        }
+
+        t.join();
+      });
+    }();
+
+    std::cout << "\nHandoff cost (ns per handoff):\n";
+    std::cout << std::right << std::setw(16) << std::setfill(' ') << "" << std::right
+              << std::setw(16) << "promise/future" << std::right << std::setw(10)
+              << "oneshot" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::right << std::setw(16) << "same thread" << std::right
+              << std::setw(16) << tstd_local << std::right << std::setw(10) << tone_local
+              << std::endl;
+    std::cout << std::right << std::setw(16) << "ping-pong" << std::right << std::setw(16)
+              << tstd_pingpong << std::right << std::setw(10) << tone_pingpong
+              << std::endl;
+    std::cout << std::defaultfloat << std::setprecision(6);
+  }
+
+  // A oneshot can be reused once its value has been consumed, and can be destroyed by the
+  // consumer as soon as get() has returned, while the producer may still be finishing
+  // set_value() on another thread.
+  void test_oneshot_reuse()
+  {
+    int const iterations = 10000;
+
+    {
+      conclib::oneshot<std::string> ping, pong;
+      std::thread t([&] {
+        for (int i = 0; i < iterations; ++i)
+          pong.set_value(ping.get() + "!");
+      });
+
+      for (int i = 0; i < iterations; ++i) {
+        auto const message = "message " + std::to_string(i);
+        ping.set_value(message);
+        [[maybe_unused]] auto const reply = pong.get();
+        assert(reply == message + "!");
+      }
+
+      t.join();
+    }
+
+    for (int i = 0; i < iterations / 10; ++i) {
+      auto channel = std::make_unique<conclib::oneshot<std::string>>();
+      std::thread t([c = channel.get(), i] {
+        if (i % 2 == 0)
+          c->set_value(std::string(64, 'x'));
+        else
+          c->set_exception(std::make_exception_ptr(std::runtime_error("failed")));
+      });
+
+      try {
+        [[maybe_unused]] auto const value = channel->get();
+        assert(i % 2 == 0 && value.size() == 64);
+      } catch (std::runtime_error const&) {
+        assert(i % 2 == 1);
+      }
+      channel.reset();
+
+      t.join();
+    }
+
+    std::cout << "\nA oneshot<std::string> was reused " << iterations
+              << " times and destroyed right after get() " << iterations / 10
+              << " times.\n";
+  }
+
   void execute()
   {
     std::cout
@@ -64,5 +218,8 @@ namespace recipe_8_06 {
 
     t1.join();
     t2.join();
+
+    test_handoff_latency();
+    test_oneshot_reuse();
   }
 }
@@ -6,7 +6,12 @@
 // results back through a promise-future channel. Do this using std::async() and
 // std::future.
 
+#include "task.h"
+#include "task_graph.h"
+#include "thread_pool.h"
+#include <chrono>
 #include <future>
+#include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <thread>
@@ -60,6 +65,122 @@ namespace recipe_8_07 {
     return 24;
   }
 
+  // The same computations as C++20 coroutine tasks. Awaiting conclib::schedule() moves
+  // the rest of the coroutine to a worker of the pool; the coroutine that awaits the
+  // task is resumed directly by the worker when the task completes.
+  conclib::task<int> compute_something_async(conclib::thread_pool& pool)
+  {
+    co_await conclib::schedule(pool);
+    co_return compute_something();
+  }
+
+  conclib::task<int> compute_something_else_async(conclib::thread_pool& pool)
+  {
+    co_await conclib::schedule(pool);
+    co_return compute_something_else();
+  }
+
+  conclib::task<int> compute_both(conclib::thread_pool& pool)
+  {
+    auto [value1, value2] = co_await conclib::when_all(
+      compute_something_async(pool), compute_something_else_async(pool));
+    co_return value1 + value2;
+  }
+
+  // Measures the time between the moment do_something() has finished and the moment the
+  // waiting code notices it, first with the wait_for() polling loop, then with a task.
+  // wait_for() returns early when the state becomes ready, but the loop still wakes up
+  // every 300ms and goes through the future's mutex and condition variable, while the
+  // awaiting coroutine is resumed directly on the thread that completed the work.
+  void test_completion_latency(conclib::thread_pool& pool)
+  {
+    using namespace std::chrono_literals;
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point finished;
+    auto f = std::async(std::launch::async, [&finished] {
+      do_something();
+      finished = clock::now();
+    });
+
+    int wakeups = 0;
+    while (f.wait_for(300ms) != std::future_status::ready)
+      ++wakeups;
+    auto const polling = clock::now() - finished;
+
+    auto run = [](conclib::thread_pool& pool) -> conclib::task<clock::time_point> {
+      co_await conclib::schedule(pool);
+      do_something();
+      co_return clock::now();
+    };
+
+    auto measure = [run](conclib::thread_pool& pool) -> conclib::task<clock::duration> {
+      auto const finished = co_await run(pool);
+      co_return clock::now() - finished;
+    };
+
+    auto const awaiting = conclib::sync_wait(measure(pool));
+
+    std::cout << "polling:  " << wakeups << " wakeups, completion noticed after "
+              << std::chrono::duration_cast<std::chrono::microseconds>(polling).count()
+              << "us" << std::endl;
+    std::cout << "co_await: 0 wakeups, completion noticed after "
+              << std::chrono::duration_cast<std::chrono::microseconds>(awaiting).count()
+              << "us" << std::endl;
+  }
+
+  // The functions above as a task graph: the two operations and the two computations
+  // are independent, the sum needs both computations, and the final report needs
+  // everything else. The graph runs on four workers without blocking any of them.
+  void test_task_graph()
+  {
+    int value1 = 0;
+    int value2 = 0;
+
+    conclib::task_graph graph;
+    auto const op1 = graph.add("do_something", do_something);
+    auto const op2 = graph.add("do_something_else", do_something_else);
+    auto const c1 = graph.add("compute_something", [&] { value1 = compute_something(); });
+    auto const c2 =
+      graph.add("compute_something_else", [&] { value2 = compute_something_else(); });
+    auto const sum = graph.add(
+      "sum",
+      [&] {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        std::cout << value1 + value2 << std::endl;
+      },
+      { c1, c2 });
+    graph.add(
+      "report",
+      [] {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        std::cout << "all done!" << std::endl;
+      },
+      { op1, op2, sum });
+
+    conclib::thread_pool pool(4);
+    graph.run(pool);
+
+    using std::chrono::milliseconds;
+    auto const timings = graph.timings();
+    std::cout << std::left << std::setw(24) << "node" << std::right << std::setw(8)
+              << "start" << std::right << std::setw(8) << "finish" << std::endl;
+    for (auto const& t : timings) {
+      std::cout << std::left << std::setw(24) << t.name << std::right << std::setw(8)
+                << std::chrono::duration_cast<milliseconds>(t.start).count()
+                << std::right << std::setw(8)
+                << std::chrono::duration_cast<milliseconds>(t.finish).count()
+                << std::endl;
+    }
+
+    auto const [length, path] = graph.critical_path();
+    std::cout << "critical path ("
+              << std::chrono::duration_cast<milliseconds>(length).count() << "ms):";
+    for (auto const id : path)
+      std::cout << ' ' << timings[id].name;
+    std::cout << std::endl;
+  }
+
   void execute()
   {
     std::cout << "\nRecipe 8.07: Executing functions asynchronously."
@@ -124,5 +245,22 @@ namespace recipe_8_07 {
         }
       std::cout << "Done!" << std::endl;
     }
+
+    {
+      std::cout << "\nAwaiting coroutine tasks instead of polling:\n";
+
+      // The tasks resume their awaiter when they complete, so the value is available
+      // as soon as the slower of the two computations is done.
+      conclib::thread_pool pool(2);
+      std::cout << conclib::sync_wait(compute_both(pool)) << std::endl;
+
+      test_completion_latency(pool);
+    }
+
+    {
+      std::cout << "\nRunning the functions as a task graph:\n";
+
+      test_task_graph();
+    }
   }
 }
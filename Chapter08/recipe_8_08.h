@@ -9,14 +9,24 @@
 //  The behavior of the objects of atomic types is well defined when one thread writes to
 //  the object and the other reads data, without using locks to protect access.
 
+#include "cache_padded.h"
+#include "epoch.h"
+#include "recipe_8_03.h"
+#include "spinlock.h"
+#include "treiber_stack.h"
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <numeric>
 #include <thread>
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <stack>
 
 namespace recipe_8_08 {
   void test_atomic()
@@ -85,13 +95,17 @@ namespace recipe_8_08 {
     for (int i = 0; i < 10; ++i) {
       threads.emplace_back(
         [&sum, &numbers](size_t const start, size_t const end) {
-          for (size_t i = start; i < end; ++i) {
-            // Use the atomic type's member functions - load(), store(), ... - to change
-            // atomic data: (The memory order specifies how non-atomic memory accesses are
-            // to be ordered around atomic operations. By default, the memory order of all
-            // atomic types and operations is sequential consistency.)
-            std::atomic_fetch_add_explicit(&sum, numbers[i], std::memory_order_acquire);
-          }
+          // Adding every element to the shared atomic would make all the threads fight
+          // for the same cache line. Sum the chunk locally and merge the result once.
+          int local = 0;
+          for (size_t i = start; i < end; ++i)
+            local += numbers[i];
+
+          // Use the atomic type's member functions - load(), store(), ... - to change
+          // atomic data: (The memory order specifies how non-atomic memory accesses are
+          // to be ordered around atomic operations. By default, the memory order of all
+          // atomic types and operations is sequential consistency.)
+          std::atomic_fetch_add_explicit(&sum, local, std::memory_order_acquire);
         },
         i * (size / 10), (i + 1) * (size / 10));
     }
@@ -153,6 +167,321 @@ namespace recipe_8_08 {
     std::cout << counter.get() << std::endl;
   }
 
+  // Every thread that increments an atomic_counter writes to the same cache line, so with
+  // many threads the counter itself becomes the bottleneck. A striped counter (like
+  // java.util.concurrent.atomic.LongAdder) spreads the updates over several cells, each
+  // on its own cache line, and only adds them up when the value is requested. Updates
+  // become cheap and scale with the number of cores, while get() costs one load per cell
+  // and is not a snapshot: increments that happen concurrently may or may not be
+  // included. For the same reason, increment() and decrement() do not return the
+  // previous value.
+  inline size_t thread_stripe()
+  {
+    static std::atomic<size_t> next{ 0 };
+    thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed);
+    return stripe;
+  }
+
+  template <typename T,
+            typename I = typename std::enable_if<std::is_integral<T>::value>::type>
+  class striped_counter {
+    std::vector<conclib::cache_padded<std::atomic<T>>> cells;
+    size_t mask;
+
+    static size_t no_of_cells()
+    {
+      size_t count = 1;
+      while (count < std::thread::hardware_concurrency())
+        count <<= 1;
+      return count;
+    }
+
+  public:
+    striped_counter()
+      : cells(no_of_cells())
+      , mask(cells.size() - 1)
+    {
+    }
+
+    void increment()
+    {
+      cells[thread_stripe() & mask]->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void decrement()
+    {
+      cells[thread_stripe() & mask]->fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    T get()
+    {
+      T sum = 0;
+      for (auto const& cell : cells)
+        sum += cell->load(std::memory_order_relaxed);
+      return sum;
+    }
+  };
+
+  template <typename Counter>
+  std::chrono::microseconds increment_concurrently(Counter& counter,
+                                                   int const no_of_threads,
+                                                   int const increments)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < no_of_threads; ++i) {
+      threads.emplace_back([&counter, increments]() {
+        for (int i = 0; i < increments; ++i)
+          counter.increment();
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  }
+
+  void test_counter_contention()
+  {
+    int const increments = 200000;
+
+    std::cout << "\nIncrementing a counter " << increments << " times per thread (us):\n";
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "threads"
+              << std::right << std::setw(10) << "atomic" << std::right << std::setw(10)
+              << "striped" << std::endl;
+
+    for (int no_of_threads : { 1, 2, 4, 8, 16, 32 }) {
+      atomic_counter<long long> c1;
+      auto t1 = increment_concurrently(c1, no_of_threads, increments);
+
+      striped_counter<long long> c2;
+      auto t2 = increment_concurrently(c2, no_of_threads, increments);
+
+      assert(c1.get() == 1LL * no_of_threads * increments);
+      assert(c2.get() == 1LL * no_of_threads * increments);
+
+      std::cout << std::right << std::setw(8) << no_of_threads << std::right
+                << std::setw(10) << t1.count() << std::right << std::setw(10)
+                << t2.count() << std::endl;
+    }
+  }
+
+  // Each thread acquires the lock iterations times with recipe_8_03::lock_guard and, in
+  // the critical section, updates shared data work times.
+  template <typename Lock>
+  std::chrono::microseconds lock_concurrently(int const no_of_threads, int const work,
+                                              int const iterations)
+  {
+    Lock lock;
+    long long counter = 0;
+    std::array<unsigned, 16> data{};
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < no_of_threads; ++i) {
+      threads.emplace_back([&]() {
+        for (int i = 0; i < iterations; ++i) {
+          recipe_8_03::lock_guard<Lock> guard(lock);
+          ++counter;
+          for (int j = 0; j < work; ++j)
+            data[j % data.size()] += j;
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    assert(counter == 1LL * no_of_threads * iterations);
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  }
+
+  void test_spinlocks()
+  {
+    int const iterations = 20000;
+
+    std::cout << "\nAcquiring a lock " << iterations << " times per thread (us):\n";
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "threads"
+              << std::right << std::setw(8) << "work" << std::right << std::setw(10)
+              << "mutex" << std::right << std::setw(10) << "ttas" << std::right
+              << std::setw(10) << "ticket" << std::right << std::setw(10) << "mcs"
+              << std::endl;
+
+    // Spinlocks are only meant for threads that run on cores of their own. With more
+    // threads than cores, the fair locks (ticket and MCS) collapse: the lock is handed
+    // to the next thread in line even when that thread is not running, and all the others
+    // have to wait until the scheduler gets to it. The matrix therefore stops at the
+    // number of hardware threads.
+    std::vector<int> thread_counts;
+    auto const max_threads
+      = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int n = 1; n < max_threads; n *= 2)
+      thread_counts.push_back(n);
+    thread_counts.push_back(max_threads);
+
+    for (int no_of_threads : thread_counts) {
+      for (int work : { 0, 50, 500 }) {
+        auto t1 = lock_concurrently<std::mutex>(no_of_threads, work, iterations);
+        auto t2
+          = lock_concurrently<conclib::ttas_spinlock>(no_of_threads, work, iterations);
+        auto t3
+          = lock_concurrently<conclib::ticket_spinlock>(no_of_threads, work, iterations);
+        auto t4 = lock_concurrently<conclib::mcs_lock>(no_of_threads, work, iterations);
+
+        std::cout << std::right << std::setw(8) << no_of_threads << std::right
+                  << std::setw(8) << work << std::right << std::setw(10) << t1.count()
+                  << std::right << std::setw(10) << t2.count() << std::right
+                  << std::setw(10) << t3.count() << std::right << std::setw(10)
+                  << t4.count() << std::endl;
+      }
+    }
+  }
+
+  // A lock-free stack can only pop a node safely if the node is not deleted while other
+  // threads may still read it; conclib::treiber_stack defers the deletion with
+  // epoch-based reclamation. The stress test checks that every pushed value is popped
+  // exactly once and that the retired nodes are eventually all deleted.
+  void test_treiber_stack()
+  {
+    int const no_of_threads = 8;
+    int const operations = 100000;
+
+    conclib::epoch_domain domain;
+    conclib::treiber_stack<long long> stack(domain);
+    std::vector<std::vector<long long>> pushed(no_of_threads);
+    std::vector<std::vector<long long>> popped(no_of_threads);
+    std::atomic<size_t> max_pending{ 0 };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < no_of_threads; ++t) {
+      threads.emplace_back([&, t]() {
+        std::mt19937 engine(t);
+        std::bernoulli_distribution coin;
+        for (int i = 0; i < operations; ++i) {
+          long long value;
+          if (coin(engine)) {
+            pushed[t].push_back(1LL * t * operations + i);
+            stack.push(pushed[t].back());
+          } else if (stack.try_pop(value))
+            popped[t].push_back(value);
+
+          auto const pending = domain.pending();
+          auto max = max_pending.load(std::memory_order_relaxed);
+          while (pending > max && !max_pending.compare_exchange_weak(max, pending))
+            ;
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    std::vector<long long> values;
+    for (auto const& p : popped)
+      values.insert(std::end(values), std::begin(p), std::end(p));
+    long long value;
+    while (stack.try_pop(value))
+      values.push_back(value);
+
+    // The values pushed by each thread are increasing, so their concatenation in the
+    // order of the threads is sorted.
+    std::vector<long long> expected;
+    for (auto const& p : pushed)
+      expected.insert(std::end(expected), std::begin(p), std::end(p));
+
+    std::sort(std::begin(values), std::end(values));
+    assert(values == expected);
+
+    // The garbage of the threads that have exited is deleted once the epoch has
+    // advanced twice.
+    for (int i = 0; i < 3; ++i)
+      domain.collect();
+    assert(domain.pending() == 0);
+
+    std::cout << "\n" << values.size() << " values pushed and popped once by "
+              << no_of_threads << " threads, at most " << max_pending
+              << " nodes awaiting deletion, " << domain.pending() << " left" << std::endl;
+  }
+
+  template <typename T>
+  class locked_stack {
+    std::stack<T> data;
+    std::mutex mutex;
+
+  public:
+    void push(T value)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      data.push(std::move(value));
+    }
+
+    bool try_pop(T& value)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (data.empty())
+        return false;
+      value = std::move(data.top());
+      data.pop();
+      return true;
+    }
+  };
+
+  // Each thread pushes a value and pops one, iterations times.
+  template <typename Stack>
+  std::chrono::microseconds push_pop_concurrently(Stack& stack, int const no_of_threads,
+                                                  int const iterations)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < no_of_threads; ++i) {
+      threads.emplace_back([&stack, iterations]() {
+        int value;
+        for (int i = 0; i < iterations; ++i) {
+          stack.push(i);
+          stack.try_pop(value);
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  }
+
+  void test_stack_throughput()
+  {
+    int const iterations = 200000;
+
+    std::cout << "\nPushing and popping " << iterations << " times per thread (us):\n";
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "threads"
+              << std::right << std::setw(10) << "mutex" << std::right << std::setw(10)
+              << "treiber" << std::endl;
+
+    for (int no_of_threads : { 1, 2, 4, 8 }) {
+      locked_stack<int> s1;
+      auto t1 = push_pop_concurrently(s1, no_of_threads, iterations);
+
+      conclib::treiber_stack<int> s2;
+      auto t2 = push_pop_concurrently(s2, no_of_threads, iterations);
+
+      std::cout << std::right << std::setw(8) << no_of_threads << std::right
+                << std::setw(10) << t1.count() << std::right << std::setw(10)
+                << t2.count() << std::endl;
+    }
+  }
+
   void execute()
   {
     std::cout << "\nRecipe 8.08: Using atomic types."
@@ -162,5 +491,9 @@ namespace recipe_8_08 {
     test_atomic_flag();
     test_fetch_arithmetic();
     test_counter();
+    test_counter_contention();
+    test_spinlocks();
+    test_treiber_stack();
+    test_stack_throughput();
   }
 }
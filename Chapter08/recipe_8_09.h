@@ -1,8 +1,13 @@
 #pragma once
 
+#include "cache_padded.h"
+#include "partitioner.h"
+#include "thread_pool.h"
+#include <atomic>
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <numeric>
@@ -73,8 +78,11 @@ namespace recipe_8_09 {
       auto part = size / no_of_threads;
       auto last = begin;
 
+      // Each thread folds its chunk into a local variable and writes its result once,
+      // into a slot that has a cache line of its own. Adjacent elements of a plain
+      // std::vector<R> would share cache lines between threads (false sharing).
       std::vector<std::thread> threads;
-      std::vector<R> values(no_of_threads);
+      std::vector<conclib::cache_padded<R>> values(no_of_threads);
       for (unsigned i = 0; i < no_of_threads; ++i) {
         if (i == no_of_threads - 1)
           last = end;
@@ -82,10 +90,8 @@ namespace recipe_8_09 {
           std::advance(last, part);
 
         threads.emplace_back(
-          [=, &op](R& result) {
-            result = std::accumulate(begin, last, R{}, std::forward<F>(op));
-          },
-          std::ref(values[i]));
+          [=, &op](R& result) { result = std::accumulate(begin, last, R{}, op); },
+          std::ref(*values[i]));
 
         begin = last;
       }
@@ -93,8 +99,153 @@ namespace recipe_8_09 {
       for (auto& t : threads)
         t.join();
 
-      return std::accumulate(std::begin(values), std::end(values), init,
-                             std::forward<F>(op));
+      for (auto const& value : values)
+        init = op(init, *value);
+
+      return init;
+    }
+  }
+
+  // The same algorithms, but the chunks are submitted to a long-lived work-stealing
+  // thread pool instead of starting and joining a new set of threads on every call.
+  namespace pooled {
+    template <typename Iter, typename F>
+    void parallel_map(Iter begin, Iter end, F f)
+    {
+      auto size = std::distance(begin, end);
+
+      if (size <= 10000)
+        std::transform(begin, end, begin, std::forward<F>(f));
+      else {
+        auto& pool = conclib::thread_pool::instance();
+        auto no_of_tasks = pool.size();
+        auto part = size / no_of_tasks;
+        auto last = begin;
+
+        std::vector<std::future<void>> tasks;
+        for (unsigned i = 0; i < no_of_tasks; ++i) {
+          if (i == no_of_tasks - 1)
+            last = end;
+          else
+            std::advance(last, part);
+
+          tasks.push_back(
+            pool.submit([=, &f] { std::transform(begin, last, begin, f); }));
+
+          begin = last;
+        }
+
+        for (auto& t : tasks)
+          pool.wait(t);
+      }
+    }
+
+    template <typename Iter, typename R, typename F>
+    auto parallel_reduce(Iter begin, Iter end, R init, F op)
+    {
+      auto size = std::distance(begin, end);
+
+      if (size <= 10000)
+        return std::accumulate(begin, end, init, std::forward<F>(op));
+      else {
+        auto& pool = conclib::thread_pool::instance();
+        auto no_of_tasks = pool.size();
+        auto part = size / no_of_tasks;
+        auto last = begin;
+
+        std::vector<std::future<R>> tasks;
+        for (unsigned i = 0; i < no_of_tasks; ++i) {
+          if (i == no_of_tasks - 1)
+            last = end;
+          else
+            std::advance(last, part);
+
+          tasks.push_back(
+            pool.submit([=, &op] { return std::accumulate(begin, last, R{}, op); }));
+
+          begin = last;
+        }
+
+        for (auto& t : tasks) {
+          pool.wait(t);
+          init = op(init, t.get());
+        }
+
+        return init;
+      }
+    }
+  }
+
+  // The same algorithms on the thread pool, but the sequential cutoff, the number of
+  // tasks and their size are chosen by conclib::adaptive_partitioner from the measured
+  // cost of the operation instead of being fixed.
+  namespace adaptive {
+    template <typename Iter, typename F>
+    void parallel_map(Iter begin, Iter end, F f)
+    {
+      auto& pool = conclib::thread_pool::instance();
+      auto const size = static_cast<size_t>(std::distance(begin, end));
+
+      auto plan = conclib::adaptive_partitioner<std::pair<F, Iter>>::plan(
+        size, pool.size(), [=, &f](size_t const first, size_t const count) {
+          auto const b = std::next(begin, first);
+          std::transform(b, std::next(b, count), b, f);
+        });
+      std::advance(begin, plan.sampled);
+
+      if (plan.no_of_tasks == 1)
+        std::transform(begin, end, begin, f);
+      else {
+        std::vector<std::future<void>> tasks;
+        while (begin != end) {
+          auto const last =
+            std::next(begin, std::min<size_t>(plan.grain, std::distance(begin, end)));
+
+          tasks.push_back(
+            pool.submit([=, &f] { std::transform(begin, last, begin, f); }));
+
+          begin = last;
+        }
+
+        for (auto& t : tasks)
+          pool.wait(t);
+      }
+    }
+
+    template <typename Iter, typename R, typename F>
+    auto parallel_reduce(Iter begin, Iter end, R init, F op)
+    {
+      auto& pool = conclib::thread_pool::instance();
+      auto const size = static_cast<size_t>(std::distance(begin, end));
+
+      auto plan = conclib::adaptive_partitioner<std::pair<F, Iter>>::plan(
+        size, pool.size(), [=, &init, &op](size_t const first, size_t const count) {
+          auto const b = std::next(begin, first);
+          init = std::accumulate(b, std::next(b, count), init, op);
+        });
+      std::advance(begin, plan.sampled);
+
+      if (plan.no_of_tasks == 1)
+        return std::accumulate(begin, end, init, op);
+      else {
+        std::vector<std::future<R>> tasks;
+        while (begin != end) {
+          auto const last =
+            std::next(begin, std::min<size_t>(plan.grain, std::distance(begin, end)));
+
+          tasks.push_back(
+            pool.submit([=, &op] { return std::accumulate(begin, last, R{}, op); }));
+
+          begin = last;
+        }
+
+        for (auto& t : tasks) {
+          pool.wait(t);
+          init = op(init, t.get());
+        }
+
+        return init;
+      }
     }
   }
 
@@ -106,7 +257,18 @@ namespace recipe_8_09 {
     std::cout << std::right << std::setw(8) << std::setfill(' ') << "size" << std::right
               << std::setw(8) << "s map" << std::right << std::setw(8) << "p map"
               << std::right << std::setw(8) << "s fold" << std::right << std::setw(8)
-              << "p fold" << std::endl;
+              << "p fold" << std::right << std::setw(8) << "tp map" << std::right
+              << std::setw(8) << "tp fold" << std::right << std::setw(8) << "a map"
+              << std::right << std::setw(8) << "a fold" << std::endl;
+
+    // An empty range is planned before any cost has been measured for the operation.
+    {
+      std::vector<int> v;
+      adaptive::parallel_map(std::begin(v), std::end(v), [](int const i) { return -i; });
+      [[maybe_unused]] auto const s =
+        adaptive::parallel_reduce(std::begin(v), std::end(v), 0LL, std::minus<>());
+      assert(v.empty() && s == 0);
+    }
 
     for (auto const size : sizes) {
       std::vector<int> v(size);
@@ -130,8 +292,32 @@ namespace recipe_8_09 {
       auto tpf = perf_timer<>::duration(
         [&] { s2 = parallel_reduce(std::begin(v2), std::end(v2), 0LL, std::plus<>()); });
 
+      auto v3 = v;
+      auto s3 = 0LL;
+      auto ttm = perf_timer<>::duration([&] {
+        pooled::parallel_map(std::begin(v3), std::end(v3),
+                             [](int const i) { return i + i; });
+      });
+      auto ttf = perf_timer<>::duration([&] {
+        s3 = pooled::parallel_reduce(std::begin(v3), std::end(v3), 0LL, std::plus<>());
+      });
+
+      auto v4 = v;
+      auto s4 = 0LL;
+      auto tam = perf_timer<>::duration([&] {
+        adaptive::parallel_map(std::begin(v4), std::end(v4),
+                               [](int const i) { return i + i; });
+      });
+      auto taf = perf_timer<>::duration([&] {
+        s4 = adaptive::parallel_reduce(std::begin(v4), std::end(v4), 0LL, std::plus<>());
+      });
+
       assert(v1 == v2);
+      assert(v1 == v3);
+      assert(v1 == v4);
       assert(s1 == s2);
+      assert(s1 == s3);
+      assert(s1 == s4);
 
       std::cout << std::right << std::setw(8) << std::setfill(' ') << size << std::right
                 << std::setw(8) << std::chrono::duration<double, std::micro>(tsm).count()
@@ -139,7 +325,101 @@ namespace recipe_8_09 {
                 << std::chrono::duration<double, std::micro>(tpm).count() << std::right
                 << std::setw(8) << std::chrono::duration<double, std::micro>(tsf).count()
                 << std::right << std::setw(8)
-                << std::chrono::duration<double, std::micro>(tpf).count() << std::endl;
+                << std::chrono::duration<double, std::micro>(tpf).count() << std::right
+                << std::setw(8) << std::chrono::duration<double, std::micro>(ttm).count()
+                << std::right << std::setw(8)
+                << std::chrono::duration<double, std::micro>(ttf).count() << std::right
+                << std::setw(8) << std::chrono::duration<double, std::micro>(tam).count()
+                << std::right << std::setw(8)
+                << std::chrono::duration<double, std::micro>(taf).count() << std::endl;
+    }
+  }
+
+  // Sums the range with the given number of threads using one of the following
+  // strategies to collect the partial results:
+  //  - shared: every element is added to a single std::atomic with fetch_add();
+  //  - adjacent: every element is added to the thread's slot of a std::vector<long long>;
+  //  - padded: the same, but every slot is on a cache line of its own;
+  //  - local: every thread sums into a local variable and merges once at the end.
+  enum class accumulation { shared, adjacent, padded, local };
+
+  long long sum_with_threads(std::vector<int> const& v, unsigned const no_of_threads,
+                             accumulation const how)
+  {
+    std::atomic<long long> shared{ 0 };
+    std::vector<long long> adjacent(no_of_threads);
+    std::vector<conclib::cache_padded<long long>> padded(no_of_threads);
+
+    auto const part = v.size() / no_of_threads;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < no_of_threads; ++i) {
+      auto const first = i * part;
+      auto const last = i == no_of_threads - 1 ? v.size() : first + part;
+
+      threads.emplace_back([&, i, first, last] {
+        switch (how) {
+        case accumulation::shared:
+          for (auto j = first; j < last; ++j)
+            shared.fetch_add(v[j], std::memory_order_relaxed);
+          break;
+        case accumulation::adjacent:
+          for (auto j = first; j < last; ++j)
+            adjacent[i] += v[j];
+          break;
+        case accumulation::padded:
+          for (auto j = first; j < last; ++j)
+            *padded[i] += v[j];
+          break;
+        case accumulation::local: {
+          auto sum = 0LL;
+          for (auto j = first; j < last; ++j)
+            sum += v[j];
+          shared.fetch_add(sum, std::memory_order_relaxed);
+        } break;
+        }
+      });
+    }
+
+    for (auto& t : threads)
+      t.join();
+
+    auto sum = shared.load();
+    for (unsigned i = 0; i < no_of_threads; ++i)
+      sum += adjacent[i] + *padded[i];
+
+    return sum;
+  }
+
+  void test_reduction_scaling()
+  {
+    std::vector<int> v(10000000);
+    std::iota(std::begin(v), std::end(v), 1);
+    [[maybe_unused]] auto const expected =
+      std::accumulate(std::begin(v), std::end(v), 0LL);
+
+    auto const max_threads = std::max(4u, get_no_of_threads());
+
+    std::cout << "\nSumming " << v.size() << " ints (us) with " << max_threads
+              << " threads at most:\n";
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "threads"
+              << std::right << std::setw(10) << "shared" << std::right << std::setw(10)
+              << "adjacent" << std::right << std::setw(10) << "padded" << std::right
+              << std::setw(10) << "local" << std::endl;
+
+    for (unsigned n = 1; n <= max_threads; ++n) {
+      std::cout << std::right << std::setw(8) << n;
+
+      for (auto how : { accumulation::shared, accumulation::adjacent,
+                        accumulation::padded, accumulation::local }) {
+        auto sum = 0LL;
+        auto t = perf_timer<>::duration([&] { sum = sum_with_threads(v, n, how); });
+        assert(sum == expected);
+
+        std::cout << std::right << std::setw(10)
+                  << std::chrono::duration<double, std::micro>(t).count();
+      }
+
+      std::cout << std::endl;
     }
   }
 
@@ -149,5 +429,6 @@ namespace recipe_8_09 {
               << "\n-------------------------------------------------------------\n";
 
     test_mapreduce_threads();
+    test_reduction_scaling();
   }
 }
@@ -0,0 +1,281 @@
+#pragma once
+
+// Parallel scan, copy_if and stable partition.
+
+// Unlike map and fold, these algorithms produce outputs whose positions depend on
+// everything before them. They are parallelized in two passes over fixed chunks:
+//  1. every chunk computes a summary independently (its sum, or the number of elements
+//     that satisfy the predicate);
+//  2. an exclusive scan over the (few) summaries gives the starting value or the output
+//     position of every chunk, and then every chunk produces its part of the output
+//     independently.
+// Both passes do the same amount of work as the sequential algorithm, so the total work
+// is about twice that of the sequential version, spread across all the workers.
+
+// The predicates of copy_if and stable_partition are evaluated twice for every element,
+// so they must not have side effects. With a single worker, the sequential algorithms
+// are used.
+
+#include "recipe_8_09.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+namespace recipe_8_09_1 {
+  using recipe_8_09::perf_timer;
+
+  // Splits [begin, end) into the given number of chunks and returns the boundaries
+  // (no_of_chunks + 1 iterators) together with the offset of every boundary.
+  template <typename Iter>
+  auto split(Iter begin, Iter end, size_t const size, size_t const no_of_chunks)
+  {
+    std::vector<std::pair<Iter, size_t>> bounds;
+    auto const part = size / no_of_chunks;
+
+    for (size_t i = 0; i < no_of_chunks; ++i) {
+      bounds.emplace_back(begin, i * part);
+      std::advance(begin, part);
+    }
+    bounds.emplace_back(end, size);
+
+    return bounds;
+  }
+
+  // Runs f(i) for every chunk i on the thread pool and waits for all of them.
+  template <typename F>
+  void for_each_chunk(size_t const no_of_chunks, F&& f)
+  {
+    auto& pool = conclib::thread_pool::instance();
+
+    std::vector<std::future<void>> tasks;
+    for (size_t i = 0; i < no_of_chunks; ++i)
+      tasks.push_back(pool.submit([i, &f] { f(i); }));
+
+    for (auto& t : tasks)
+      pool.wait(t);
+  }
+
+  template <typename Iter, typename OutIter, typename F>
+  OutIter parallel_inclusive_scan(Iter begin, Iter end, OutIter d_begin, F op)
+  {
+    auto size = static_cast<size_t>(std::distance(begin, end));
+    auto const no_of_chunks = conclib::thread_pool::instance().size();
+
+    if (size <= 10000 || no_of_chunks == 1)
+      return std::inclusive_scan(begin, end, d_begin, op);
+    else {
+      using T = typename std::iterator_traits<Iter>::value_type;
+
+      auto const bounds = split(begin, end, size, no_of_chunks);
+
+      // The sum of every chunk but the last, which is not needed.
+      std::vector<T> sums(no_of_chunks);
+      for_each_chunk(no_of_chunks - 1, [&](size_t const i) {
+        auto first = bounds[i].first;
+        sums[i] = std::accumulate(std::next(first), bounds[i + 1].first, *first, op);
+      });
+
+      // sums[i] becomes the sum of all the elements before chunk i + 1.
+      for (size_t i = 1; i < no_of_chunks - 1; ++i)
+        sums[i] = op(sums[i - 1], sums[i]);
+
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        auto const d_first = std::next(d_begin, bounds[i].second);
+        if (i == 0)
+          std::inclusive_scan(bounds[i].first, bounds[i + 1].first, d_first, op);
+        else
+          std::inclusive_scan(bounds[i].first, bounds[i + 1].first, d_first, op,
+                              sums[i - 1]);
+      });
+
+      return std::next(d_begin, size);
+    }
+  }
+
+  template <typename Iter, typename OutIter, typename T, typename F>
+  OutIter parallel_exclusive_scan(Iter begin, Iter end, OutIter d_begin, T init, F op)
+  {
+    auto size = static_cast<size_t>(std::distance(begin, end));
+    auto const no_of_chunks = conclib::thread_pool::instance().size();
+
+    if (size <= 10000 || no_of_chunks == 1)
+      return std::exclusive_scan(begin, end, d_begin, init, op);
+    else {
+      auto const bounds = split(begin, end, size, no_of_chunks);
+
+      // The value that precedes every chunk: init for the first one, and the sum of
+      // init and all the elements before it for the others.
+      std::vector<T> offsets(no_of_chunks, init);
+      for_each_chunk(no_of_chunks - 1, [&](size_t const i) {
+        auto first = bounds[i].first;
+        offsets[i + 1] =
+          std::accumulate(std::next(first), bounds[i + 1].first, T(*first), op);
+      });
+
+      for (size_t i = 1; i < no_of_chunks; ++i)
+        offsets[i] = op(offsets[i - 1], offsets[i]);
+
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        std::exclusive_scan(bounds[i].first, bounds[i + 1].first,
+                            std::next(d_begin, bounds[i].second), offsets[i], op);
+      });
+
+      return std::next(d_begin, size);
+    }
+  }
+
+  template <typename Iter, typename OutIter, typename P>
+  OutIter parallel_copy_if(Iter begin, Iter end, OutIter d_begin, P pred)
+  {
+    auto size = static_cast<size_t>(std::distance(begin, end));
+    auto const no_of_chunks = conclib::thread_pool::instance().size();
+
+    if (size <= 10000 || no_of_chunks == 1)
+      return std::copy_if(begin, end, d_begin, pred);
+    else {
+      auto const bounds = split(begin, end, size, no_of_chunks);
+
+      // positions[i + 1] is the number of selected elements in chunk i, and after the
+      // scan, the output position of chunk i + 1.
+      std::vector<size_t> positions(no_of_chunks + 1, 0);
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        positions[i + 1] = std::count_if(bounds[i].first, bounds[i + 1].first, pred);
+      });
+
+      std::partial_sum(std::begin(positions), std::end(positions), std::begin(positions));
+
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        std::copy_if(bounds[i].first, bounds[i + 1].first,
+                     std::next(d_begin, positions[i]), pred);
+      });
+
+      return std::next(d_begin, positions.back());
+    }
+  }
+
+  // Stable partition through a temporary buffer: the elements of every chunk are moved
+  // to their final position in the buffer (the selected ones at the front, the others
+  // after all the selected ones), and then moved back.
+  template <typename Iter, typename P>
+  Iter parallel_stable_partition(Iter begin, Iter end, P pred)
+  {
+    auto size = static_cast<size_t>(std::distance(begin, end));
+    auto const no_of_chunks = conclib::thread_pool::instance().size();
+
+    if (size <= 10000 || no_of_chunks == 1)
+      return std::stable_partition(begin, end, pred);
+    else {
+      using T = typename std::iterator_traits<Iter>::value_type;
+
+      auto const bounds = split(begin, end, size, no_of_chunks);
+
+      std::vector<size_t> selected(no_of_chunks + 1, 0);
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        selected[i + 1] = std::count_if(bounds[i].first, bounds[i + 1].first, pred);
+      });
+
+      std::partial_sum(std::begin(selected), std::end(selected), std::begin(selected));
+      auto const total = selected.back();
+
+      std::vector<T> buffer(size);
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        // The rejected elements before chunk i are all the elements before it minus
+        // the selected ones.
+        auto in = std::begin(buffer) + selected[i];
+        auto out = std::begin(buffer) + total + (bounds[i].second - selected[i]);
+
+        for (auto it = bounds[i].first; it != bounds[i + 1].first; ++it) {
+          if (pred(*it))
+            *in++ = std::move(*it);
+          else
+            *out++ = std::move(*it);
+        }
+      });
+
+      for_each_chunk(no_of_chunks, [&](size_t const i) {
+        std::move(std::begin(buffer) + bounds[i].second,
+                  std::begin(buffer) + bounds[i + 1].second, bounds[i].first);
+      });
+
+      return std::next(begin, total);
+    }
+  }
+
+  void test_scan_partition()
+  {
+    std::vector<int> sizes{ 10000, 100000, 500000, 1000000, 2000000, 5000000, 10000000 };
+
+    auto const is_even = [](int const i) { return i % 2 == 0; };
+
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "size" << std::right
+              << std::setw(9) << "s iscan" << std::right << std::setw(9) << "p iscan"
+              << std::right << std::setw(9) << "s escan" << std::right << std::setw(9)
+              << "p escan" << std::right << std::setw(9) << "s copyif" << std::right
+              << std::setw(9) << "p copyif" << std::right << std::setw(9) << "s part"
+              << std::right << std::setw(9) << "p part" << std::endl;
+
+    for (auto const size : sizes) {
+      std::vector<long long> v(size);
+      std::iota(std::begin(v), std::end(v), 1);
+      std::transform(std::begin(v), std::end(v), std::begin(v),
+                     [](long long const i) { return (i * 7919) % 1000; });
+
+      std::vector<long long> s1(size), s2(size);
+      auto tsi = perf_timer<>::duration(
+        [&] { std::inclusive_scan(std::begin(v), std::end(v), std::begin(s1)); });
+      auto tpi = perf_timer<>::duration([&] {
+        parallel_inclusive_scan(std::begin(v), std::end(v), std::begin(s2),
+                                std::plus<>());
+      });
+      assert(s1 == s2);
+
+      auto tse = perf_timer<>::duration(
+        [&] { std::exclusive_scan(std::begin(v), std::end(v), std::begin(s1), 42LL); });
+      auto tpe = perf_timer<>::duration([&] {
+        parallel_exclusive_scan(std::begin(v), std::end(v), std::begin(s2), 42LL,
+                                std::plus<>());
+      });
+      assert(s1 == s2);
+
+      std::vector<long long> c1(size), c2(size);
+      auto e1 = std::begin(c1), e2 = std::begin(c2);
+      auto tsc = perf_timer<>::duration(
+        [&] { e1 = std::copy_if(std::begin(v), std::end(v), std::begin(c1), is_even); });
+      auto tpc = perf_timer<>::duration([&] {
+        e2 = parallel_copy_if(std::begin(v), std::end(v), std::begin(c2), is_even);
+      });
+      assert(e1 - std::begin(c1) == e2 - std::begin(c2));
+      assert(c1 == c2);
+
+      auto p1 = v, p2 = v;
+      auto m1 = std::begin(p1), m2 = std::begin(p2);
+      auto tsp = perf_timer<>::duration(
+        [&] { m1 = std::stable_partition(std::begin(p1), std::end(p1), is_even); });
+      auto tpp = perf_timer<>::duration(
+        [&] { m2 = parallel_stable_partition(std::begin(p2), std::end(p2), is_even); });
+      assert(m1 - std::begin(p1) == m2 - std::begin(p2));
+      assert(p1 == p2);
+
+      std::cout << std::right << std::setw(8) << std::setfill(' ') << size;
+      for (auto const t : { tsi, tpi, tse, tpe, tsc, tpc, tsp, tpp })
+        std::cout << std::right << std::setw(9)
+                  << std::chrono::duration<double, std::micro>(t).count();
+      std::cout << std::endl;
+    }
+  }
+
+  void execute()
+  {
+    std::cout << "\nRecipe 8.09.1: Implementing parallel scan, copy_if and partition."
+              << "\n-----------------------------------------------------------------\n";
+
+    test_scan_partition();
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+// Fusing map and fold into a single pass over memory.
+
+// Running parallel_map() and then parallel_reduce() on the same data traverses it twice.
+// For cheap operations such as i + i the processor waits for memory most of the time, so
+// the second traversal costs almost as much as the first one. parallel_transform_reduce()
+// maps and folds every element while it is still in a register: each task applies the
+// map to its chunk and accumulates the mapped values immediately. When only the result
+// of the fold is needed, the mapped values do not have to be written back either, which
+// halves the memory traffic once more.
+
+#include "recipe_8_09.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+namespace recipe_8_09_2 {
+  using recipe_8_09::perf_timer;
+
+  // Whether parallel_transform_reduce() stores the mapped values in the input range.
+  enum class mapped_values { keep, discard };
+
+  // Maps and folds the chunk [begin, end) in a single loop.
+  template <typename Iter, typename R, typename F, typename M>
+  R transform_reduce_chunk(Iter begin, Iter end, R init, F op, M f,
+                           mapped_values const values)
+  {
+    if (values == mapped_values::keep) {
+      for (; begin != end; ++begin) {
+        *begin = f(*begin);
+        init = op(init, *begin);
+      }
+    } else {
+      for (; begin != end; ++begin)
+        init = op(init, f(*begin));
+    }
+
+    return init;
+  }
+
+  template <typename Iter, typename R, typename F, typename M>
+  auto parallel_transform_reduce(Iter begin, Iter end, R init, F op, M f,
+                                 mapped_values const values = mapped_values::keep)
+  {
+    auto size = std::distance(begin, end);
+
+    if (size <= 10000)
+      return transform_reduce_chunk(begin, end, init, op, f, values);
+    else {
+      auto& pool = conclib::thread_pool::instance();
+      auto no_of_tasks = pool.size();
+      auto part = size / no_of_tasks;
+      auto last = begin;
+
+      std::vector<std::future<R>> tasks;
+      for (unsigned i = 0; i < no_of_tasks; ++i) {
+        if (i == no_of_tasks - 1)
+          last = end;
+        else
+          std::advance(last, part);
+
+        tasks.push_back(pool.submit([=, &op, &f] {
+          return transform_reduce_chunk(begin, last, R{}, op, f, values);
+        }));
+
+        begin = last;
+      }
+
+      for (auto& t : tasks) {
+        pool.wait(t);
+        init = op(init, t.get());
+      }
+
+      return init;
+    }
+  }
+
+  void test_fused_mapreduce()
+  {
+    std::vector<int> sizes{ 10000,   100000,   500000,   1000000, 2000000,
+                            5000000, 10000000, 25000000, 50000000 };
+
+    auto const twice = [](int const i) { return i + i; };
+
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "size" << std::right
+              << std::setw(10) << "s m+f" << std::right << std::setw(10) << "s fused"
+              << std::right << std::setw(10) << "tp m+f" << std::right << std::setw(10)
+              << "tp fused" << std::right << std::setw(10) << "tp nowr" << std::endl;
+
+    for (auto const size : sizes) {
+      std::vector<int> v(size);
+      std::iota(std::begin(v), std::end(v), 1);
+
+      auto v1 = v;
+      auto s1 = 0LL;
+      auto tsmf = perf_timer<>::duration([&] {
+        std::transform(std::begin(v1), std::end(v1), std::begin(v1), twice);
+        s1 = std::accumulate(std::begin(v1), std::end(v1), 0LL);
+      });
+
+      auto v2 = v;
+      auto s2 = 0LL;
+      auto tsfu = perf_timer<>::duration([&] {
+        s2 = transform_reduce_chunk(std::begin(v2), std::end(v2), 0LL, std::plus<>(),
+                                    twice, mapped_values::keep);
+      });
+
+      auto v3 = v;
+      auto s3 = 0LL;
+      auto tpmf = perf_timer<>::duration([&] {
+        recipe_8_09::pooled::parallel_map(std::begin(v3), std::end(v3), twice);
+        s3 = recipe_8_09::pooled::parallel_reduce(std::begin(v3), std::end(v3), 0LL,
+                                                  std::plus<>());
+      });
+
+      auto v4 = v;
+      auto s4 = 0LL;
+      auto tpfu = perf_timer<>::duration([&] {
+        s4 = parallel_transform_reduce(std::begin(v4), std::end(v4), 0LL, std::plus<>(),
+                                       twice);
+      });
+
+      auto s5 = 0LL;
+      auto tpnw = perf_timer<>::duration([&] {
+        s5 = parallel_transform_reduce(std::begin(v), std::end(v), 0LL, std::plus<>(),
+                                       twice, mapped_values::discard);
+      });
+
+      assert(v1 == v2);
+      assert(v1 == v3);
+      assert(v1 == v4);
+      assert(s1 == s2);
+      assert(s1 == s3);
+      assert(s1 == s4);
+      assert(s1 == s5);
+
+      std::cout << std::right << std::setw(8) << std::setfill(' ') << size;
+      for (auto const t : { tsmf, tsfu, tpmf, tpfu, tpnw })
+        std::cout << std::right << std::setw(10)
+                  << std::chrono::duration<double, std::micro>(t).count();
+      std::cout << std::endl;
+    }
+  }
+
+  void execute()
+  {
+    std::cout << "\nRecipe 8.09.2: Fusing parallel map and fold."
+              << "\n--------------------------------------------\n";
+
+    test_fused_mapreduce();
+  }
+}
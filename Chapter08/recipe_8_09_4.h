@@ -0,0 +1,143 @@
+#pragma once
+
+// Parallel map and fold over ranges without random access.
+
+// parallel_map() and parallel_reduce() first compute the size of the range with
+// std::distance() and then find the chunk boundaries with std::advance(). For a
+// std::list or a std::forward_list both are linear walks through the nodes, done by the
+// calling thread before any worker starts: the list is traversed one and a half times
+// sequentially, and then once more, in parallel, by the workers.
+
+// The algorithms below walk the range once. Every grain elements, the segment that has
+// just been walked is handed to the thread pool (through a conclib::task_group), so the
+// workers start processing the beginning of the list while the calling thread is still
+// walking the rest of it. The size of the range is never needed.
+
+#include "recipe_8_09.h"
+#include "task_group.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <numeric>
+#include <vector>
+
+namespace recipe_8_09_4 {
+  using recipe_8_09::perf_timer;
+
+  constexpr size_t default_grain = 8192;
+
+  // Walks the range once and, for every consecutive segment of at most grain elements,
+  // spawns the task returned by make_task(first, last) on the thread pool. make_task()
+  // runs on the calling thread, in the order of the segments. Returns when all the tasks
+  // have completed.
+  template <typename Iter, typename MakeTask>
+  void spawn_segments(Iter begin, Iter end, size_t const grain, MakeTask make_task)
+  {
+    conclib::task_group tasks;
+
+    while (begin != end) {
+      auto last = begin;
+      for (size_t n = 0; n < grain && last != end; ++n)
+        ++last;
+
+      tasks.spawn(make_task(begin, last));
+      begin = last;
+    }
+
+    tasks.sync();
+  }
+
+  template <typename Iter, typename F>
+  void parallel_map(Iter begin, Iter end, F f, size_t const grain = default_grain)
+  {
+    spawn_segments(begin, end, grain, [&f](Iter first, Iter last) {
+      return [=, &f] { std::transform(first, last, first, f); };
+    });
+  }
+
+  template <typename Iter, typename R, typename F>
+  auto parallel_reduce(Iter begin, Iter end, R init, F op,
+                       size_t const grain = default_grain)
+  {
+    // A std::deque does not move its elements when it grows, so the tasks can write
+    // their results while the traversal is still appending slots.
+    std::deque<R> partials;
+
+    spawn_segments(begin, end, grain, [&](Iter first, Iter last) {
+      auto& slot = partials.emplace_back();
+      return [=, &slot, &op] { slot = std::accumulate(first, last, R{}, op); };
+    });
+
+    for (auto const& value : partials)
+      init = op(init, value);
+
+    return init;
+  }
+
+  void test_mapreduce_lists()
+  {
+    std::vector<int> sizes{ 10000, 100000, 500000, 1000000, 2000000, 5000000 };
+
+    std::cout << std::right << std::setw(8) << std::setfill(' ') << "size" << std::right
+              << std::setw(9) << "s map" << std::right << std::setw(9) << "p map"
+              << std::right << std::setw(9) << "seg map" << std::right << std::setw(9)
+              << "s fold" << std::right << std::setw(9) << "p fold" << std::right
+              << std::setw(9) << "seg fold" << std::endl;
+
+    auto const twice = [](int const i) { return i + i; };
+
+    for (auto const size : sizes) {
+      std::list<int> l(size);
+      std::iota(std::begin(l), std::end(l), 1);
+
+      auto l1 = l;
+      auto s1 = 0LL;
+      auto tsm = perf_timer<>::duration(
+        [&] { std::transform(std::begin(l1), std::end(l1), std::begin(l1), twice); });
+      auto tsf = perf_timer<>::duration(
+        [&] { s1 = std::accumulate(std::begin(l1), std::end(l1), 0LL); });
+
+      auto l2 = l;
+      auto s2 = 0LL;
+      auto tpm = perf_timer<>::duration([&] {
+        recipe_8_09::pooled::parallel_map(std::begin(l2), std::end(l2), twice);
+      });
+      auto tpf = perf_timer<>::duration([&] {
+        s2 = recipe_8_09::pooled::parallel_reduce(std::begin(l2), std::end(l2), 0LL,
+                                                  std::plus<>());
+      });
+
+      auto l3 = l;
+      auto s3 = 0LL;
+      auto tgm = perf_timer<>::duration(
+        [&] { parallel_map(std::begin(l3), std::end(l3), twice); });
+      auto tgf = perf_timer<>::duration([&] {
+        s3 = parallel_reduce(std::begin(l3), std::end(l3), 0LL, std::plus<>());
+      });
+
+      assert(l1 == l2);
+      assert(l1 == l3);
+      assert(s1 == s2);
+      assert(s1 == s3);
+
+      std::cout << std::right << std::setw(8) << std::setfill(' ') << size;
+      for (auto const t : { tsm, tpm, tgm, tsf, tpf, tgf })
+        std::cout << std::right << std::setw(9)
+                  << std::chrono::duration<double, std::micro>(t).count();
+      std::cout << std::endl;
+    }
+  }
+
+  void execute()
+  {
+    std::cout << "\nRecipe 8.09.4: Implementing parallel map and fold over lists."
+              << "\n-------------------------------------------------------------\n";
+
+    test_mapreduce_lists();
+  }
+}
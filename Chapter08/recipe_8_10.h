@@ -4,6 +4,8 @@
 // std::async() enables us to execute functions asynchronously, without the need to handle
 // lower-level threading details.
 
+#include "future.h"
+#include "task_group.h"
 #include <algorithm>
 #include <cassert>
 #include <chrono>
@@ -107,7 +109,9 @@ namespace recipe_8_10 {
     }
   }
 
-  // Using deferred launching policy
+  // Using recursive fork-join on a task group. Each level of the recursion spawns the
+  // first half as a task and processes the second half on the current thread; the tasks
+  // run on the workers of the thread pool instead of on new threads.
   namespace version2 {
     template <typename Iter, typename F>
     void parallel_map(Iter begin, Iter end, F f)
@@ -120,11 +124,10 @@ namespace recipe_8_10 {
         auto middle = begin;
         std::advance(middle, size / 2);
 
-        // deferred launching policy
-        auto result = std::async(std::launch::deferred, parallel_map<Iter, F>, begin,
-                                 middle, std::forward<F>(f));
-        parallel_map(middle, end, std::forward<F>(f));
-        result.wait();
+        conclib::task_group tasks;
+        tasks.spawn([=, &f] { parallel_map(begin, middle, f); });
+        parallel_map(middle, end, f);
+        tasks.sync();
       }
     }
 
@@ -139,12 +142,94 @@ namespace recipe_8_10 {
         auto middle = begin;
         std::advance(middle, size / 2);
 
-        // deferred launching policy
-        auto result1 = std::async(std::launch::async, parallel_reduce<Iter, R, F>, begin,
-                                  middle, R{}, std::forward<F>(op));
+        R result1{};
+        conclib::task_group tasks;
+        tasks.spawn(
+          [=, &result1, &op] { result1 = parallel_reduce(begin, middle, init, op); });
 
-        auto result2 = parallel_reduce(middle, end, init, std::forward<F>(op));
-        return result1.get() + result2;
+        auto result2 = parallel_reduce(middle, end, R{}, op);
+        tasks.sync();
+
+        return op(result1, result2);
+      }
+    }
+  }
+
+  // Using executor-backed futures with continuations
+  namespace version3 {
+    template <typename Iter, typename F>
+    void parallel_map(Iter begin, Iter end, F f)
+    {
+      auto size = std::distance(begin, end);
+
+      if (size <= 10000)
+        std::transform(begin, end, begin, std::forward<F>(f));
+      else {
+        auto& pool = conclib::thread_pool::instance();
+        auto no_of_tasks = pool.size();
+        auto part = size / no_of_tasks;
+        auto last = begin;
+
+        std::vector<conclib::future<void>> tasks;
+        for (unsigned i = 0; i < no_of_tasks; ++i) {
+          if (i == no_of_tasks - 1)
+            last = end;
+          else
+            std::advance(last, part);
+
+          tasks.push_back(conclib::async(
+            pool, [=, &f] { std::transform(begin, last, begin, f); }));
+
+          begin = last;
+        }
+
+        conclib::when_all(std::move(tasks)).get();
+      }
+    }
+
+    template <typename Iter, typename R, typename F>
+    auto parallel_reduce(Iter begin, Iter end, R init, F op)
+    {
+      auto size = std::distance(begin, end);
+
+      if (size <= 10000)
+        return std::accumulate(begin, end, init, std::forward<F>(op));
+      else {
+        auto& pool = conclib::thread_pool::instance();
+        auto no_of_tasks = pool.size();
+        auto part = size / no_of_tasks;
+        auto last = begin;
+
+        std::vector<conclib::future<R>> partials;
+        for (unsigned i = 0; i < no_of_tasks; ++i) {
+          if (i == no_of_tasks - 1)
+            last = end;
+          else
+            std::advance(last, part);
+
+          partials.push_back(conclib::async(
+            pool, [=] { return std::accumulate(begin, last, R{}, op); }));
+
+          begin = last;
+        }
+
+        // Combine the partial results pairwise in a tree of continuations. Each
+        // combination runs as soon as both of its inputs are ready and no worker thread
+        // ever waits for another one; only the caller blocks, once, on the root.
+        while (partials.size() > 1) {
+          std::vector<conclib::future<R>> next;
+          for (size_t i = 0; i + 1 < partials.size(); i += 2) {
+            next.push_back(
+              conclib::when_all(std::move(partials[i]), std::move(partials[i + 1]))
+                .then([op](std::pair<R, R> v) { return op(v.first, v.second); }));
+          }
+          if (partials.size() % 2 == 1)
+            next.push_back(std::move(partials.back()));
+
+          partials.swap(next);
+        }
+
+        return op(init, partials.front().get());
       }
     }
   }
@@ -158,7 +243,8 @@ namespace recipe_8_10 {
               << std::setw(8) << "s map" << std::right << std::setw(8) << "p1 map"
               << std::right << std::setw(8) << "p2 map" << std::right << std::setw(8)
               << "s fold" << std::right << std::setw(8) << "p1 fold" << std::right
-              << std::setw(8) << "p2 fold" << std::endl;
+              << std::setw(8) << "p2 fold" << std::right << std::setw(8) << "p3 map"
+              << std::right << std::setw(8) << "p3 fold" << std::endl;
 
     for (auto const size : sizes) {
       std::vector<int> v(size);
@@ -194,11 +280,23 @@ namespace recipe_8_10 {
         s3 = version2::parallel_reduce(std::begin(v3), std::end(v3), 0LL, std::plus<>());
       });
 
+      auto v4 = v;
+      auto s4 = 0LL;
+      auto tp3m = perf_timer<>::duration([&] {
+        version3::parallel_map(std::begin(v4), std::end(v4),
+                               [](int const i) { return i + i; });
+      });
+      auto tp3f = perf_timer<>::duration([&] {
+        s4 = version3::parallel_reduce(std::begin(v4), std::end(v4), 0LL, std::plus<>());
+      });
+
       assert(v1 == v2);
       assert(v1 == v3);
+      assert(v1 == v4);
 
       assert(s1 == s2);
       assert(s1 == s3);
+      assert(s1 == s4);
 
       std::cout << std::right << std::setw(8) << std::setfill(' ') << size << std::right
                 << std::setw(8) << std::chrono::duration<double, std::micro>(tsm).count()
@@ -209,7 +307,10 @@ namespace recipe_8_10 {
                 << std::chrono::duration<double, std::micro>(tsf).count() << std::right
                 << std::setw(8) << std::chrono::duration<double, std::micro>(tp1f).count()
                 << std::right << std::setw(8)
-                << std::chrono::duration<double, std::micro>(tp2f).count() << std::endl;
+                << std::chrono::duration<double, std::micro>(tp2f).count() << std::right
+                << std::setw(8) << std::chrono::duration<double, std::micro>(tp3m).count()
+                << std::right << std::setw(8)
+                << std::chrono::duration<double, std::micro>(tp3f).count() << std::endl;
     }
   }
 
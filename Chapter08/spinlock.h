@@ -0,0 +1,232 @@
+#pragma once
+
+// A small family of spinlocks built on std::atomic.
+
+// A spinlock busy-waits instead of asking the operating system to suspend the thread. For
+// very short critical sections this avoids the cost of a context switch, but a naive
+// spinlock (a loop on atomic_flag::test_and_set(), see recipe 8.08) has several problems:
+//  - every iteration is an atomic read-modify-write that takes the cache line in
+//    exclusive mode, so the waiting threads slow down the owner of the lock;
+//  - the loop has no pause instruction, which wastes power and, on processors with
+//    hyper-threading, steals execution resources from the sibling thread;
+//  - it is unfair: a thread can be starved indefinitely.
+
+// The locks below satisfy the BasicLockable requirements (lock() and unlock()) and can
+// be used with std::lock_guard, std::unique_lock or recipe_8_03::lock_guard:
+//  - ttas_spinlock (test-and-test-and-set): waiting threads only read the lock, from
+//    their own cache, and back off exponentially after each failed attempt;
+//  - ticket_spinlock: threads are served in the order they arrived (FIFO fairness);
+//  - mcs_lock: a queue lock where every waiting thread spins on its own node, so a
+//    release touches the cache of a single waiter.
+
+// All of them fall back to std::this_thread::yield() after spinning for a while, so that
+// they degrade gracefully when there are more threads than cores.
+
+// Reference: J. Mellor-Crummey and M. Scott, Algorithms for Scalable Synchronization on
+// Shared-Memory Multiprocessors, 1991.
+
+#include "cache_padded.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace conclib {
+  // Tells the processor that the thread is in a spin-wait loop.
+  inline void cpu_relax() noexcept
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#endif
+  }
+
+  // Exponential backoff: spins 1, 2, 4, ... times between attempts and yields the
+  // processor once the limit is reached.
+  class backoff {
+    static constexpr unsigned max_spins = 1024;
+    unsigned spins = 1;
+
+  public:
+    void pause() noexcept
+    {
+      if (spins <= max_spins) {
+        for (unsigned i = 0; i < spins; ++i)
+          cpu_relax();
+        spins <<= 1;
+      } else
+        std::this_thread::yield();
+    }
+  };
+
+  class ttas_spinlock {
+    std::atomic<bool> locked{ false };
+
+  public:
+    void lock() noexcept
+    {
+      backoff b;
+      while (true) {
+        if (!locked.exchange(true, std::memory_order_acquire))
+          return;
+
+        while (locked.load(std::memory_order_relaxed))
+          b.pause();
+      }
+    }
+
+    bool try_lock() noexcept
+    {
+      return !locked.load(std::memory_order_relaxed)
+             && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() noexcept
+    {
+      locked.store(false, std::memory_order_release);
+    }
+  };
+
+  class ticket_spinlock {
+    alignas(cache_line_size) std::atomic<unsigned> next_ticket{ 0 };
+    alignas(cache_line_size) std::atomic<unsigned> now_serving{ 0 };
+
+  public:
+    void lock() noexcept
+    {
+      auto const ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+
+      unsigned attempts = 0;
+      while (true) {
+        auto const serving = now_serving.load(std::memory_order_acquire);
+        if (serving == ticket)
+          return;
+
+        // Proportional backoff: the further back in the line, the longer the wait.
+        if (++attempts < 64) {
+          for (unsigned i = 0, n = (ticket - serving) * 32; i < n; ++i)
+            cpu_relax();
+        } else
+          std::this_thread::yield();
+      }
+    }
+
+    bool try_lock() noexcept
+    {
+      auto serving = now_serving.load(std::memory_order_relaxed);
+      auto ticket = serving;
+      return next_ticket.compare_exchange_strong(ticket, serving + 1,
+                                                 std::memory_order_acquire);
+    }
+
+    void unlock() noexcept
+    {
+      // Only the owner writes now_serving, so a load and a store are enough.
+      now_serving.store(now_serving.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+    }
+  };
+
+  class mcs_lock {
+    struct alignas(cache_line_size) node {
+      std::atomic<node*> next{ nullptr };
+      std::atomic<bool> locked{ false };
+    };
+
+    // The classic MCS interface passes the queue node to both lock() and unlock(). To
+    // satisfy BasicLockable, nodes come from a per-thread free list and the owner
+    // remembers its node in the lock itself (only the owner reads or writes it).
+    static node* acquire_node()
+    {
+      auto& nodes = free_nodes();
+      if (nodes.empty())
+        return new node;
+
+      auto n = nodes.back().release();
+      nodes.pop_back();
+      return n;
+    }
+
+    static void release_node(node* n)
+    {
+      free_nodes().emplace_back(n);
+    }
+
+    static std::vector<std::unique_ptr<node>>& free_nodes()
+    {
+      thread_local std::vector<std::unique_ptr<node>> nodes;
+      return nodes;
+    }
+
+    std::atomic<node*> tail{ nullptr };
+    node* owner = nullptr;
+
+  public:
+    mcs_lock() = default;
+    mcs_lock(mcs_lock const&) = delete;
+    mcs_lock& operator=(mcs_lock const&) = delete;
+
+    void lock()
+    {
+      auto n = acquire_node();
+      n->next.store(nullptr, std::memory_order_relaxed);
+      n->locked.store(true, std::memory_order_relaxed);
+
+      auto const predecessor = tail.exchange(n, std::memory_order_acq_rel);
+      if (predecessor != nullptr) {
+        predecessor->next.store(n, std::memory_order_release);
+
+        backoff b;
+        while (n->locked.load(std::memory_order_acquire))
+          b.pause();
+      }
+
+      owner = n;
+    }
+
+    bool try_lock()
+    {
+      auto n = acquire_node();
+      n->next.store(nullptr, std::memory_order_relaxed);
+
+      node* expected = nullptr;
+      if (tail.compare_exchange_strong(expected, n, std::memory_order_acquire)) {
+        owner = n;
+        return true;
+      }
+
+      release_node(n);
+      return false;
+    }
+
+    void unlock()
+    {
+      auto n = owner;
+      auto successor = n->next.load(std::memory_order_acquire);
+
+      if (successor == nullptr) {
+        auto expected = n;
+        if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+          release_node(n);
+          return;
+        }
+
+        // A thread has already swapped itself into the tail but has not linked itself
+        // to our node yet.
+        backoff b;
+        while ((successor = n->next.load(std::memory_order_acquire)) == nullptr)
+          b.pause();
+      }
+
+      successor->locked.store(false, std::memory_order_release);
+      release_node(n);
+    }
+  };
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+// A bounded single-producer/single-consumer wait-free ring buffer.
+
+// When a channel has exactly one producer and one consumer, neither side ever competes
+// with another thread for its own index: the producer is the only writer of the tail and
+// the consumer the only writer of the head. Pushing and popping need no compare-and-swap
+// and no lock, only a load of the other side's index and a release store of their own,
+// so every operation completes in a bounded number of steps (wait-free).
+
+// The two indices live on separate cache lines, so the producer and the consumer do not
+// invalidate each other's cache on every operation. In addition, each side keeps a
+// private copy of the other side's index and only reloads it (which pulls the cache line
+// from the other core) when the copy says the queue is full or empty. With batches, a
+// whole run of elements is made visible to the other side with a single release store.
+
+// The blocking push() and pop() spin and yield briefly and then sleep with the C++20
+// std::atomic::wait(); the try_ operations never block.
+
+// Reference: the cached-index layout is the one used by Erik Rigtorp's SPSCQueue:
+// https://github.com/rigtorp/SPSCQueue
+
+#include "cache_padded.h"
+#include "spinlock.h"
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace conclib {
+  template <typename T>
+  class spsc_queue {
+  public:
+    // The capacity is rounded up to a power of two.
+    explicit spsc_queue(size_t const capacity)
+      : mask(round_up(capacity) - 1)
+      , buffer(new T[mask + 1])
+    {
+    }
+
+    spsc_queue(spsc_queue const&) = delete;
+    spsc_queue& operator=(spsc_queue const&) = delete;
+
+    size_t capacity() const noexcept
+    {
+      return mask + 1;
+    }
+
+    // Producer side.
+
+    bool try_push(T value)
+    {
+      auto const t = tail.load(std::memory_order_relaxed);
+      if (t - cached_head > mask) {
+        cached_head = head.load(std::memory_order_acquire);
+        if (t - cached_head > mask)
+          return false;
+      }
+
+      buffer[t & mask] = std::move(value);
+      publish(tail, t + 1);
+      return true;
+    }
+
+    // Pushes as many elements of the range as there is room for, and makes all of them
+    // visible to the consumer at once. Returns the number of pushed elements.
+    template <typename Iter>
+    size_t try_push_batch(Iter first, Iter last)
+    {
+      auto const t = tail.load(std::memory_order_relaxed);
+      auto const wanted = static_cast<size_t>(std::distance(first, last));
+
+      if (capacity() - (t - cached_head) < wanted)
+        cached_head = head.load(std::memory_order_acquire);
+
+      auto const count = std::min(wanted, capacity() - (t - cached_head));
+      if (count == 0)
+        return 0;
+
+      for (size_t i = 0; i < count; ++i, ++first)
+        buffer[(t + i) & mask] = *first;
+
+      publish(tail, t + count);
+      return count;
+    }
+
+    void push(T value)
+    {
+      auto const t = tail.load(std::memory_order_relaxed);
+      while (t - cached_head > mask) {
+        cached_head = wait_for_change(head, t - capacity());
+      }
+
+      buffer[t & mask] = std::move(value);
+      publish(tail, t + 1);
+    }
+
+    template <typename Iter>
+    void push_batch(Iter first, Iter last)
+    {
+      while (first != last) {
+        auto const pushed = try_push_batch(first, last);
+        if (pushed == 0) {
+          push(*first);
+          ++first;
+        } else
+          std::advance(first, pushed);
+      }
+    }
+
+    // Consumer side.
+
+    bool try_pop(T& value)
+    {
+      auto const h = head.load(std::memory_order_relaxed);
+      if (h == cached_tail) {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if (h == cached_tail)
+          return false;
+      }
+
+      value = std::move(buffer[h & mask]);
+      publish(head, h + 1);
+      return true;
+    }
+
+    // Pops up to max_count elements and releases their slots to the producer at once.
+    // Returns the number of popped elements.
+    template <typename OutIter>
+    size_t try_pop_batch(OutIter out, size_t const max_count)
+    {
+      auto const h = head.load(std::memory_order_relaxed);
+      if (cached_tail - h < max_count)
+        cached_tail = tail.load(std::memory_order_acquire);
+
+      auto const count = std::min(max_count, cached_tail - h);
+      if (count == 0)
+        return 0;
+
+      for (size_t i = 0; i < count; ++i)
+        *out++ = std::move(buffer[(h + i) & mask]);
+
+      publish(head, h + count);
+      return count;
+    }
+
+    T pop()
+    {
+      auto const h = head.load(std::memory_order_relaxed);
+      while (h == cached_tail)
+        cached_tail = wait_for_change(tail, h);
+
+      T value = std::move(buffer[h & mask]);
+      publish(head, h + 1);
+      return value;
+    }
+
+    // Blocks until at least one element is available and then pops up to max_count
+    // elements. Returns the number of popped elements.
+    template <typename OutIter>
+    size_t pop_batch(OutIter out, size_t const max_count)
+    {
+      if (max_count == 0)
+        return 0;
+
+      auto const h = head.load(std::memory_order_relaxed);
+      while (h == cached_tail)
+        cached_tail = wait_for_change(tail, h);
+
+      return try_pop_batch(out, max_count);
+    }
+
+  private:
+    static size_t round_up(size_t const value)
+    {
+      size_t result = 2;
+      while (result < value)
+        result <<= 1;
+      return result;
+    }
+
+    // The notification is cheap when nobody waits: the standard library keeps track of
+    // the waiters and only makes a system call when there is one.
+    static void publish(std::atomic<size_t>& index, size_t const value)
+    {
+      index.store(value, std::memory_order_release);
+      index.notify_one();
+    }
+
+    // Waits until the other side's index is different from the given value and returns
+    // its new value. The thread spins (only on multiple cores, where the other side can
+    // make progress meanwhile), then yields, and only then sleeps: a sleeping side makes
+    // every publish() of the other side a system call until it has woken up.
+    static size_t wait_for_change(std::atomic<size_t> const& index, size_t const old)
+    {
+      static int const spins = std::thread::hardware_concurrency() > 1 ? 256 : 0;
+      for (int i = 0; i < spins + yields; ++i) {
+        auto const value = index.load(std::memory_order_acquire);
+        if (value != old)
+          return value;
+
+        if (i < spins)
+          cpu_relax();
+        else
+          std::this_thread::yield();
+      }
+
+      index.wait(old, std::memory_order_acquire);
+      return index.load(std::memory_order_acquire);
+    }
+
+    static constexpr int yields = 64;
+
+    size_t const mask;
+    std::unique_ptr<T[]> buffer;
+
+    // Written by the producer.
+    alignas(cache_line_size) std::atomic<size_t> tail{ 0 };
+    size_t cached_head = 0;
+
+    // Written by the consumer.
+    alignas(cache_line_size) std::atomic<size_t> head{ 0 };
+    size_t cached_tail = 0;
+  };
+}
@@ -0,0 +1,403 @@
+#pragma once
+
+// Coroutine-based tasks (C++20).
+
+// A task<T> is a coroutine that produces a value of type T. It is lazy: it starts when
+// it is awaited with co_await. When it completes, it resumes the coroutine that awaited
+// it directly (with symmetric transfer), so there is no polling and no thread waiting on
+// a condition variable in between. Work is moved to other threads explicitly, by
+// awaiting schedule() on a conclib::thread_pool.
+
+// Only the outermost caller, which is not a coroutine, blocks: sync_wait() starts a task
+// and sleeps until it has completed. when_all() starts two tasks concurrently and
+// resumes the awaiting coroutine when the last of them completes.
+
+// This follows the design of cppcoro by Lewis Baker:
+// https://github.com/lewissbaker/cppcoro
+
+#include "thread_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace conclib {
+  template <typename T = void>
+  class task;
+
+  namespace detail {
+    struct task_promise_base {
+      std::coroutine_handle<> continuation = std::noop_coroutine();
+      std::exception_ptr error;
+
+      struct final_awaiter {
+        bool await_ready() noexcept
+        {
+          return false;
+        }
+
+        // Resumes the awaiting coroutine, if any, on the current thread.
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+
+        void await_resume() noexcept
+        {
+        }
+      };
+
+      std::suspend_always initial_suspend() noexcept
+      {
+        return {};
+      }
+
+      final_awaiter final_suspend() noexcept
+      {
+        return {};
+      }
+
+      void unhandled_exception() noexcept
+      {
+        error = std::current_exception();
+      }
+    };
+
+    template <typename T>
+    struct task_promise : task_promise_base {
+      std::optional<T> value;
+
+      task<T> get_return_object() noexcept;
+
+      template <typename U>
+      void return_value(U&& v)
+      {
+        value.emplace(std::forward<U>(v));
+      }
+
+      T result()
+      {
+        if (error)
+          std::rethrow_exception(error);
+        return std::move(*value);
+      }
+    };
+
+    template <>
+    struct task_promise<void> : task_promise_base {
+      task<void> get_return_object() noexcept;
+
+      void return_void() noexcept
+      {
+      }
+
+      void result()
+      {
+        if (error)
+          std::rethrow_exception(error);
+      }
+    };
+  }
+
+  template <typename T>
+  class task {
+  public:
+    using promise_type = detail::task_promise<T>;
+
+    task(task&& other) noexcept
+      : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+
+    task& operator=(task&& other) noexcept
+    {
+      if (this != &other) {
+        if (handle)
+          handle.destroy();
+        handle = std::exchange(other.handle, nullptr);
+      }
+      return *this;
+    }
+
+    task(task const&) = delete;
+    task& operator=(task const&) = delete;
+
+    ~task()
+    {
+      if (handle)
+        handle.destroy();
+    }
+
+    bool is_ready() const noexcept
+    {
+      return !handle || handle.done();
+    }
+
+    // Starts the task and resumes the awaiting coroutine when it completes, without
+    // retrieving the result.
+    auto when_ready() const noexcept
+    {
+      struct awaiter {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() const noexcept
+        {
+          return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+          handle.promise().continuation = awaiting;
+          return handle;
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+      };
+
+      return awaiter{ handle };
+    }
+
+    // The value of a completed task, or the exception it ended with.
+    T result()
+    {
+      return handle.promise().result();
+    }
+
+    auto operator co_await() noexcept
+    {
+      struct awaiter {
+        task& t;
+
+        bool await_ready() const noexcept
+        {
+          return t.is_ready();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+          t.handle.promise().continuation = awaiting;
+          return t.handle;
+        }
+
+        T await_resume()
+        {
+          return t.result();
+        }
+      };
+
+      return awaiter{ *this };
+    }
+
+  private:
+    friend struct detail::task_promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept
+      : handle(h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  namespace detail {
+    template <typename T>
+    task<T> task_promise<T>::get_return_object() noexcept
+    {
+      return task<T>{ std::coroutine_handle<task_promise<T>>::from_promise(*this) };
+    }
+
+    inline task<void> task_promise<void>::get_return_object() noexcept
+    {
+      return task<void>{ std::coroutine_handle<task_promise<void>>::from_promise(*this) };
+    }
+
+    // A coroutine that runs a task to completion and then notifies its owner. The owner
+    // returns the coroutine to resume next, if any. It is the bridge between tasks and
+    // code that is not a coroutine.
+    template <typename Owner>
+    struct notifying_task {
+      struct promise_type {
+        Owner* owner;
+
+        template <typename... Args>
+        promise_type(Owner& o, Args&...) noexcept
+          : owner(&o)
+        {
+        }
+
+        notifying_task get_return_object() noexcept
+        {
+          return { std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+          return {};
+        }
+
+        auto final_suspend() noexcept
+        {
+          struct awaiter {
+            bool await_ready() noexcept
+            {
+              return false;
+            }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+              return h.promise().owner->notify();
+            }
+
+            void await_resume() noexcept
+            {
+            }
+          };
+
+          return awaiter{};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+          std::terminate();
+        }
+      };
+
+      std::coroutine_handle<promise_type> handle;
+    };
+
+    struct sync_wait_state {
+      std::mutex mutex;
+      std::condition_variable cv;
+      bool done = false;
+
+      std::coroutine_handle<> notify()
+      {
+        // Notifying under the lock guarantees that sync_wait() cannot return, and
+        // destroy this state, before the notification is complete.
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_one();
+        return std::noop_coroutine();
+      }
+    };
+
+    template <typename T>
+    notifying_task<sync_wait_state> run_and_notify(sync_wait_state&, task<T>& t)
+    {
+      co_await t.when_ready();
+    }
+
+    struct when_all_counter {
+      std::atomic<int> count;
+      std::coroutine_handle<> continuation;
+
+      std::coroutine_handle<> notify() noexcept
+      {
+        if (count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          return continuation;
+        return std::noop_coroutine();
+      }
+    };
+
+    template <typename T>
+    notifying_task<when_all_counter> run_and_notify(when_all_counter&, task<T>& t)
+    {
+      co_await t.when_ready();
+    }
+  }
+
+  // An awaitable that moves the awaiting coroutine to a worker of the pool.
+  inline auto schedule(thread_pool& pool) noexcept
+  {
+    struct awaiter {
+      thread_pool& pool;
+
+      bool await_ready() const noexcept
+      {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> h)
+      {
+        pool.post([h] { h.resume(); });
+      }
+
+      void await_resume() const noexcept
+      {
+      }
+    };
+
+    return awaiter{ pool };
+  }
+
+  // Starts the task and blocks the calling thread until it has completed.
+  template <typename T>
+  T sync_wait(task<T> t)
+  {
+    detail::sync_wait_state state;
+    auto runner = detail::run_and_notify(state, t);
+    runner.handle.resume();
+
+    {
+      std::unique_lock<std::mutex> lock(state.mutex);
+      state.cv.wait(lock, [&state] { return state.done; });
+    }
+
+    runner.handle.destroy();
+    return t.result();
+  }
+
+  // Runs both tasks concurrently (as far as they move themselves to other threads) and
+  // produces both results when the last of them completes.
+  template <typename A, typename B>
+  task<std::pair<A, B>> when_all(task<A> a, task<B> b)
+  {
+    // One count for each task, and one for the awaiting coroutine itself: whoever
+    // decrements the count to zero, resumes the coroutine.
+    detail::when_all_counter counter{ 3, {} };
+    auto ra = detail::run_and_notify(counter, a);
+    auto rb = detail::run_and_notify(counter, b);
+
+    struct awaiter {
+      detail::when_all_counter& counter;
+      std::coroutine_handle<> ra;
+      std::coroutine_handle<> rb;
+
+      bool await_ready() const noexcept
+      {
+        return false;
+      }
+
+      bool await_suspend(std::coroutine_handle<> h) noexcept
+      {
+        counter.continuation = h;
+        ra.resume();
+        rb.resume();
+        return counter.count.fetch_sub(1, std::memory_order_acq_rel) != 1;
+      }
+
+      void await_resume() const noexcept
+      {
+      }
+    };
+
+    co_await awaiter{ counter, ra.handle, rb.handle };
+
+    ra.handle.destroy();
+    rb.handle.destroy();
+
+    co_return std::pair<A, B>(a.result(), b.result());
+  }
+}
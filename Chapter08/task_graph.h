@@ -0,0 +1,221 @@
+#pragma once
+
+// A task graph: a set of tasks with dependencies between them, executed on a thread pool.
+
+// Expressing dependencies with futures means that a task that needs the results of two
+// others blocks its thread in get() until they are available. In a task graph every node
+// declares its predecessors up front, and the runtime only submits a node to the pool
+// when all its predecessors have completed: each node has a counter of unfinished
+// predecessors, and the worker that completes the last of them submits the node. No
+// worker ever waits for another one.
+
+// Nodes can only depend on nodes that have already been added, so the graph is acyclic
+// by construction and the order of insertion is a topological order. If a node throws,
+// the nodes that depend on it (directly or not) are skipped and run() rethrows the first
+// exception once the rest of the graph has completed.
+
+// After run(), the graph reports when every node started and finished and its critical
+// path: the chain of dependent nodes with the longest total duration. No schedule can
+// complete the graph faster than the critical path, whatever the number of threads.
+
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace conclib {
+  class task_graph {
+  public:
+    using node_id = std::size_t;
+    using clock = std::chrono::steady_clock;
+
+    struct node_timing {
+      std::string name;
+      clock::duration start;  // since the beginning of run()
+      clock::duration finish; // since the beginning of run()
+      bool executed;
+    };
+
+    // Adds a node that executes work after all the given nodes have completed.
+    node_id add(std::string name, std::function<void()> work,
+                std::vector<node_id> const& predecessors = {})
+    {
+      auto const id = nodes.size();
+      auto n = std::make_unique<node>();
+      n->name = std::move(name);
+      n->work = std::move(work);
+
+      for (auto const p : predecessors) {
+        if (p >= id)
+          throw std::out_of_range("task_graph: unknown predecessor");
+        nodes[p]->successors.push_back(id);
+        n->predecessors.push_back(p);
+      }
+
+      nodes.push_back(std::move(n));
+      return id;
+    }
+
+    std::size_t size() const noexcept
+    {
+      return nodes.size();
+    }
+
+    // Executes the whole graph on the pool and returns when all the nodes have
+    // completed. A worker of the pool that calls run() executes nodes in the meantime.
+    // The graph can be run again afterwards.
+    void run(thread_pool& pool = thread_pool::instance())
+    {
+      if (nodes.empty())
+        return;
+
+      for (auto& n : nodes) {
+        n->pending.store(n->predecessors.size(), std::memory_order_relaxed);
+        n->skipped.store(false, std::memory_order_relaxed);
+        n->executed = false;
+      }
+      remaining.store(nodes.size(), std::memory_order_relaxed);
+      done = false;
+      error = nullptr;
+      started = clock::now();
+
+      for (node_id id = 0; id < nodes.size(); ++id)
+        if (nodes[id]->predecessors.empty())
+          submit(pool, id);
+
+      while (remaining.load(std::memory_order_acquire) > 0) {
+        if (!pool.run_pending_task()) {
+          if (pool.current_worker() < 0)
+            break;
+          std::this_thread::yield();
+        }
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return done; });
+      }
+
+      if (error)
+        std::rethrow_exception(error);
+    }
+
+    // The timings of the last run, in the order the nodes were added.
+    std::vector<node_timing> timings() const
+    {
+      std::vector<node_timing> result;
+      for (auto const& n : nodes)
+        result.push_back(
+          { n->name, n->start - started, n->finish - started, n->executed });
+
+      return result;
+    }
+
+    // The length of the critical path of the last run and the nodes along it.
+    std::pair<clock::duration, std::vector<node_id>> critical_path() const
+    {
+      // The longest path that ends with every node. Predecessors always come before
+      // their successors, so a single pass in insertion order is enough.
+      std::vector<clock::duration> length(nodes.size());
+      std::vector<node_id> previous(nodes.size(), nodes.size());
+
+      node_id last = 0;
+      for (node_id id = 0; id < nodes.size(); ++id) {
+        clock::duration longest{ 0 };
+        for (auto const p : nodes[id]->predecessors) {
+          if (length[p] > longest) {
+            longest = length[p];
+            previous[id] = p;
+          }
+        }
+
+        length[id] = longest + (nodes[id]->finish - nodes[id]->start);
+        if (length[id] > length[last])
+          last = id;
+      }
+
+      std::vector<node_id> path;
+      if (!nodes.empty()) {
+        for (auto id = last; id < nodes.size(); id = previous[id])
+          path.insert(std::begin(path), id);
+      }
+
+      return { nodes.empty() ? clock::duration{ 0 } : length[last], path };
+    }
+
+  private:
+    struct node {
+      std::string name;
+      std::function<void()> work;
+      std::vector<node_id> predecessors;
+      std::vector<node_id> successors;
+
+      std::atomic<std::size_t> pending{ 0 };
+      std::atomic<bool> skipped{ false };
+      bool executed = false;
+      clock::time_point start;
+      clock::time_point finish;
+    };
+
+    void submit(thread_pool& pool, node_id const id)
+    {
+      pool.post([this, &pool, id] { execute(pool, id); });
+    }
+
+    void execute(thread_pool& pool, node_id const id)
+    {
+      auto& n = *nodes[id];
+      bool failed = n.skipped.load(std::memory_order_relaxed);
+
+      n.start = clock::now();
+      if (!failed) {
+        try {
+          n.work();
+          n.executed = true;
+        } catch (...) {
+          failed = true;
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+        }
+      }
+      n.finish = clock::now();
+
+      // The acquire-release decrement publishes the results of this node (and the
+      // skipped flag) to the worker that executes the successor.
+      for (auto const s : n.successors) {
+        auto& successor = *nodes[s];
+        if (failed)
+          successor.skipped.store(true, std::memory_order_relaxed);
+        if (successor.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          submit(pool, s);
+      }
+
+      // Only the last node touches the graph after decrementing the counter, and it
+      // does so under the mutex that run() acquires before returning.
+      if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_one();
+      }
+    }
+
+    std::vector<std::unique_ptr<node>> nodes;
+    std::atomic<std::size_t> remaining{ 0 };
+    clock::time_point started;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error;
+  };
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// Fork-join parallelism on top of conclib::thread_pool.
+
+// A recursive divide-and-conquer algorithm splits its input in two, processes one half
+// asynchronously and the other one on the current thread, and joins the two when both are
+// done. Doing that with std::async(std::launch::async, ...) creates a new thread at every
+// level of the recursion, so large inputs create thousands of threads. A task_group runs
+// the forked work on the bounded set of workers of a thread pool instead:
+//  - spawn() pushes a task into the deque of the calling worker (help-first: the parent
+//    continues and the child waits to be picked up, by the same worker or by a thief);
+//  - sync() waits until all the tasks spawned in the group have completed, and executes
+//    queued tasks in the meantime (the worker's own children first), so a worker never
+//    sits idle while there is work it could do and nested syncs cannot deadlock.
+
+// If a task throws, the first exception is rethrown by sync(). The destructor waits for
+// the outstanding tasks, but does not rethrow.
+
+#include "thread_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace conclib {
+  class task_group {
+  public:
+    explicit task_group(thread_pool& pool = thread_pool::instance())
+      : pool(pool)
+    {
+    }
+
+    task_group(task_group const&) = delete;
+    task_group& operator=(task_group const&) = delete;
+
+    ~task_group()
+    {
+      wait_all();
+    }
+
+    template <typename F>
+    void spawn(F&& f)
+    {
+      outstanding.fetch_add(1, std::memory_order_relaxed);
+
+      pool.post([this, f = std::forward<F>(f)]() mutable {
+        try {
+          f();
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+        }
+
+        task_done();
+      });
+    }
+
+    void sync()
+    {
+      wait_all();
+
+      if (error)
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+
+  private:
+    // The count includes one reference held by the group itself, which is only released
+    // in wait_all(). A task that does not bring the count to zero does not touch the
+    // group after decrementing it, so the group may be destroyed as soon as the last
+    // task has signalled completion under the mutex.
+    void task_done()
+    {
+      if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        cv.notify_one();
+      }
+    }
+
+    void wait_all()
+    {
+      while (outstanding.load(std::memory_order_acquire) > 1) {
+        if (!pool.run_pending_task()) {
+          // Only threads that are not workers of the pool may block.
+          if (pool.current_worker() < 0)
+            break;
+          std::this_thread::yield();
+        }
+      }
+
+      if (outstanding.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return finished; });
+      }
+
+      finished = false;
+      outstanding.store(1, std::memory_order_relaxed);
+    }
+
+    thread_pool& pool;
+    std::atomic<size_t> outstanding{ 1 };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool finished = false;
+    std::exception_ptr error;
+  };
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+// A long-lived work-stealing thread pool.
+
+// Creating and joining std::thread objects is expensive (a system call for each thread,
+// a new stack, and the scheduler has to pick them up). For small and medium-sized
+// workloads this cost dominates the actual work. A thread pool starts its worker threads
+// once and then feeds them with tasks for the lifetime of the program.
+
+// Each worker owns a double-ended queue of tasks. A worker pushes and pops tasks at the
+// back of its own queue (LIFO, which is cache friendly), and when its queue is empty it
+// steals from the front of the queues of the other workers (FIFO, which takes the
+// oldest and usually largest pieces of work). Workers that find no work at all park on a
+// condition variable instead of spinning, and they are woken up when new tasks arrive.
+
+#include "cache_padded.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace conclib {
+  class thread_pool {
+  public:
+    using task = std::function<void()>;
+
+    explicit thread_pool(unsigned const no_of_threads
+                         = std::max(1u, std::thread::hardware_concurrency()))
+    {
+      for (unsigned i = 0; i < no_of_threads; ++i)
+        queues.push_back(std::make_unique<worker_queue>());
+
+      for (unsigned i = 0; i < no_of_threads; ++i)
+        threads.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+
+    // Graceful shutdown: all the tasks that have already been submitted are executed
+    // before the worker threads are joined.
+    ~thread_pool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        done = true;
+      }
+      park_cv.notify_all();
+
+      for (auto& t : threads)
+        t.join();
+    }
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    // A process-wide pool, created on first use and shut down at program exit.
+    static thread_pool& instance()
+    {
+      static thread_pool pool;
+      return pool;
+    }
+
+    unsigned size() const noexcept
+    {
+      return static_cast<unsigned>(threads.size());
+    }
+
+    // Returns the index of the calling thread if it is a worker of this pool, or -1.
+    int current_worker() const noexcept
+    {
+      return tl_pool == this ? static_cast<int>(tl_index) : -1;
+    }
+
+    // Enqueues a task without a way to retrieve its result. Tasks submitted from a
+    // worker go to that worker's own queue, the others are distributed round-robin.
+    void post(task t)
+    {
+      auto index = current_worker();
+      if (index < 0)
+        index = static_cast<int>(next_queue.fetch_add(1, std::memory_order_relaxed)
+                                 % queues.size());
+
+      {
+        auto& q = *queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(t));
+      }
+
+      // The increment of pending and the read of idle (and the reverse in
+      // worker_loop()) are sequentially consistent, so either the poster sees the
+      // parked worker or the worker sees the new task before it parks.
+      pending.fetch_add(1);
+      if (idle.load() > 0) {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        park_cv.notify_one();
+      }
+    }
+
+    // Enqueues a task and returns a future for its result.
+    template <typename F>
+    auto submit(F&& f) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+      using R = std::invoke_result_t<std::decay_t<F>>;
+
+      // std::function requires copyable targets, while std::packaged_task is move-only.
+      auto pt = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+      auto result = pt->get_future();
+      post([pt] { (*pt)(); });
+
+      return result;
+    }
+
+    // Executes one queued task on the calling thread, if there is any. Workers look
+    // into their own queue first; every thread may steal from the other queues.
+    bool run_pending_task()
+    {
+      task t;
+      auto const index = current_worker();
+
+      if ((index >= 0 && pop_local(index, t)) || steal(index, t)) {
+        t();
+        return true;
+      }
+
+      return false;
+    }
+
+    // Waits for a future produced by this pool and executes queued tasks in the
+    // meantime. A worker must never block here, otherwise nested waits can deadlock the
+    // pool; other threads only help while there is something to steal.
+    template <typename T>
+    void wait(std::future<T> const& f)
+    {
+      using namespace std::chrono_literals;
+
+      while (f.wait_for(0s) != std::future_status::ready) {
+        if (!run_pending_task()) {
+          if (current_worker() < 0) {
+            f.wait();
+            return;
+          }
+          std::this_thread::yield();
+        }
+      }
+    }
+
+  private:
+    struct alignas(cache_line_size) worker_queue {
+      std::mutex mutex;
+      std::deque<task> tasks;
+    };
+
+    bool pop_local(int const index, task& t)
+    {
+      auto& q = *queues[index];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty())
+        return false;
+
+      t = std::move(q.tasks.back());
+      q.tasks.pop_back();
+      pending.fetch_sub(1);
+      return true;
+    }
+
+    bool steal(int const thief, task& t)
+    {
+      auto const count = queues.size();
+      auto const start = thief >= 0 ? static_cast<size_t>(thief) + 1
+                                    : next_queue.load(std::memory_order_relaxed);
+
+      for (size_t i = 0; i < count; ++i) {
+        auto const victim = (start + i) % count;
+        if (static_cast<int>(victim) == thief)
+          continue;
+
+        auto& q = *queues[victim];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+          t = std::move(q.tasks.front());
+          q.tasks.pop_front();
+          pending.fetch_sub(1);
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    void worker_loop(unsigned const index)
+    {
+      tl_pool = this;
+      tl_index = index;
+
+      while (true) {
+        if (run_pending_task())
+          continue;
+
+        std::unique_lock<std::mutex> lock(park_mutex);
+        idle.fetch_add(1);
+        park_cv.wait(lock, [this] { return done || pending.load() > 0; });
+        idle.fetch_sub(1);
+
+        if (done && pending.load() == 0)
+          break;
+      }
+
+      tl_pool = nullptr;
+    }
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> pending{ 0 };
+    std::atomic<unsigned> idle{ 0 };
+    std::atomic<unsigned> next_queue{ 0 };
+
+    std::mutex park_mutex;
+    std::condition_variable park_cv;
+    bool done = false;
+
+    inline static thread_local thread_pool* tl_pool = nullptr;
+    inline static thread_local unsigned tl_index = 0;
+  };
+}
@@ -0,0 +1,403 @@
+#pragma once
+
+// A hierarchical hashed timer wheel for delayed and periodic callbacks.
+
+// Implementing a delay with std::this_thread::sleep_for() occupies a thread for the whole
+// duration of the delay, and a priority queue of deadlines costs O(log n) for every
+// insertion and cancellation. A timer wheel divides time into ticks and keeps the timers
+// in an array of slots indexed by their expiration tick, like the hands of a clock, so
+// starting and cancelling a timer are O(1) operations.
+
+// A single wheel of 256 slots only covers 256 ticks. This implementation has four levels
+// of 256 slots each; level k covers deltas up to 256^(k+1) ticks. Timers that expire far
+// in the future are placed in a higher level and are moved down (cascaded) to a lower
+// level when the lower levels have gone through a full revolution, so every timer is
+// moved at most three times. Deadlines further away than 2^32 ticks stay in the last
+// level until they come within range.
+
+// Timers are nodes of intrusive doubly linked lists, allocated from a pool inside the
+// wheel (no allocation per timer once the pool has grown). A timer_id carries a
+// generation number, so cancelling a timer that has already fired, or whose node has
+// been reused, is detected and ignored.
+
+// This follows the design described in: G. Varghese and T. Lauck, Hashed and
+// Hierarchical Timing Wheels, 1987.
+
+#include "thread_pool.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace conclib {
+  class timer_wheel {
+  public:
+    using clock = std::chrono::steady_clock;
+    using callback = std::function<void()>;
+
+    struct timer_id {
+      std::uint32_t index = invalid;
+      std::uint32_t generation = 0;
+    };
+
+    explicit timer_wheel(clock::duration const resolution = std::chrono::milliseconds(1),
+                         clock::time_point const start = clock::now())
+      : resolution(resolution), start(start)
+    {
+      for (auto& level : wheels)
+        level.fill(invalid);
+    }
+
+    timer_wheel(timer_wheel const&) = delete;
+    timer_wheel& operator=(timer_wheel const&) = delete;
+
+    // Runs the callback once, at the first tick at or after the deadline.
+    timer_id schedule_at(clock::time_point const deadline, callback f)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return add(to_tick(deadline), 0, std::move(f));
+    }
+
+    timer_id schedule_after(clock::duration const delay, callback f)
+    {
+      return schedule_at(clock::now() + delay, std::move(f));
+    }
+
+    // Runs the callback every period (rounded to whole ticks, at least one), starting
+    // one period from now.
+    timer_id schedule_every(clock::duration const period, callback f)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto const ticks = std::max<std::uint64_t>(1, period / resolution);
+      return add(to_tick(clock::now() + period), ticks, std::move(f));
+    }
+
+    // Returns false if the timer has already fired (one-shot timers) or was cancelled.
+    bool cancel(timer_id const id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (id.index >= nodes.size() || nodes[id.index].generation != id.generation
+          || !nodes[id.index].active)
+        return false;
+
+      unlink(id.index);
+      release(id.index);
+      return true;
+    }
+
+    std::size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return count;
+    }
+
+    // Processes all the ticks up to now and passes the callback of every expired timer
+    // to dispatch(). The callbacks are dispatched after the wheel has been unlocked, so
+    // they may start and cancel timers. Returns the number of expired timers.
+    template <typename Dispatch>
+    std::size_t advance(clock::time_point const now, Dispatch&& dispatch)
+    {
+      std::vector<callback> expired;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const target = to_tick(now);
+
+        while (current < target) {
+          // Nothing happens in the ticks before the next cascade of the lowest level
+          // that holds timers, so they are skipped.
+          unsigned lowest = 0;
+          while (lowest < levels && population[lowest] == 0)
+            ++lowest;
+
+          if (lowest == levels) {
+            current = target;
+            break;
+          }
+
+          if (lowest > 0) {
+            auto const period = span(lowest - 1);
+            current = std::min(target, (current / period + 1) * period - 1);
+            if (current == target)
+              break;
+          }
+
+          ++current;
+          process_tick(expired);
+        }
+      }
+
+      for (auto& f : expired)
+        dispatch(std::move(f));
+
+      return expired.size();
+    }
+
+  private:
+    static constexpr std::uint32_t invalid = std::numeric_limits<std::uint32_t>::max();
+    static constexpr unsigned levels = 4;
+    static constexpr unsigned bits_per_level = 8;
+    static constexpr std::uint64_t slots_per_level = 1 << bits_per_level;
+    static constexpr std::uint64_t slot_mask = slots_per_level - 1;
+
+    struct node {
+      std::uint64_t expiry = 0;
+      std::uint64_t period = 0;
+      callback f;
+      std::uint32_t prev = invalid;
+      std::uint32_t next = invalid;
+      std::uint32_t generation = 0;
+      std::uint32_t* head = nullptr; // the slot that holds the node
+      unsigned level = 0;
+      bool active = false;
+    };
+
+    // The number of ticks covered by the levels up to and including the given one.
+    static constexpr std::uint64_t span(unsigned const level)
+    {
+      return std::uint64_t{ 1 } << (bits_per_level * (level + 1));
+    }
+
+    std::uint64_t to_tick(clock::time_point const t) const
+    {
+      return t <= start ? 0 : static_cast<std::uint64_t>((t - start) / resolution);
+    }
+
+    timer_id add(std::uint64_t const expiry, std::uint64_t const period, callback f)
+    {
+      std::uint32_t index;
+      if (free_list != invalid) {
+        index = free_list;
+        free_list = nodes[index].next;
+      } else {
+        index = static_cast<std::uint32_t>(nodes.size());
+        nodes.emplace_back();
+      }
+
+      // Timers that are already due expire at the next tick.
+      auto& n = nodes[index];
+      n.expiry = std::max(expiry, current + 1);
+      n.period = period;
+      n.f = std::move(f);
+      n.active = true;
+      ++count;
+
+      link(index);
+      return { index, n.generation };
+    }
+
+    void release(std::uint32_t const index)
+    {
+      auto& n = nodes[index];
+      n.f = nullptr;
+      n.active = false;
+      ++n.generation;
+      n.next = free_list;
+      free_list = index;
+      --count;
+    }
+
+    // Puts the node in the slot determined by its expiration tick, relative to the
+    // current tick. A timer cascaded at the tick it expires goes to the current slot of
+    // the first level, which is processed after the cascades.
+    void link(std::uint32_t const index)
+    {
+      auto& n = nodes[index];
+      auto const expiry = n.expiry;
+      auto const delta = expiry - current;
+
+      unsigned level = 0;
+      while (level < levels - 1 && delta >= span(level))
+        ++level;
+
+      // Beyond the range of the last level, park the timer in the slot that is cascaded
+      // last; it is placed again when that happens.
+      auto const shift = bits_per_level * level;
+      auto const max_delta = span(levels - 1);
+      auto const placed = delta < max_delta ? expiry : current + max_delta - 1;
+      auto& head = wheels[level][(placed >> shift) & slot_mask];
+
+      n.prev = invalid;
+      n.next = head;
+      if (head != invalid)
+        nodes[head].prev = index;
+      head = index;
+      n.head = &head;
+      n.level = level;
+      ++population[level];
+    }
+
+    void unlink(std::uint32_t const index)
+    {
+      auto& n = nodes[index];
+      if (n.prev != invalid)
+        nodes[n.prev].next = n.next;
+      else
+        *n.head = n.next;
+      if (n.next != invalid)
+        nodes[n.next].prev = n.prev;
+
+      n.prev = n.next = invalid;
+      n.head = nullptr;
+      --population[n.level];
+    }
+
+    void process_tick(std::vector<callback>& expired)
+    {
+      // When the lower levels complete a revolution, the timers of the next slot of the
+      // level above are distributed over the lower levels. Higher levels go first, so
+      // that timers they move into a slot that is due at this tick are cascaded again.
+      unsigned top = 0;
+      while (top < levels - 1 && (current & (span(top) - 1)) == 0)
+        ++top;
+
+      for (auto level = top; level > 0; --level) {
+        auto& head = wheels[level][(current >> (bits_per_level * level)) & slot_mask];
+        auto index = std::exchange(head, invalid);
+        while (index != invalid) {
+          auto const next = nodes[index].next;
+          --population[level];
+          link(index);
+          index = next;
+        }
+      }
+
+      auto& head = wheels[0][current & slot_mask];
+      auto index = std::exchange(head, invalid);
+      while (index != invalid) {
+        auto& n = nodes[index];
+        auto const next = n.next;
+        --population[0];
+
+        if (n.expiry > current) {
+          // A deadline that was beyond the range of the wheel.
+          link(index);
+        } else if (n.period > 0) {
+          expired.push_back(n.f);
+          n.expiry = current + n.period;
+          link(index);
+        } else {
+          expired.push_back(std::move(n.f));
+          n.prev = n.next = invalid;
+          n.head = nullptr;
+          release(index);
+        }
+
+        index = next;
+      }
+    }
+
+    clock::duration const resolution;
+    clock::time_point const start;
+
+    mutable std::mutex mutex;
+    std::uint64_t current = 0;
+    std::array<std::array<std::uint32_t, slots_per_level>, levels> wheels;
+    std::array<std::size_t, levels> population{}; // the number of timers in every level
+    std::vector<node> nodes;
+    std::uint32_t free_list = invalid;
+    std::size_t count = 0;
+  };
+
+  // A timer wheel driven by a background thread, which dispatches the expired callbacks
+  // to a thread pool. A single thread serves any number of timers, and the callbacks
+  // never delay each other or the wheel. Timers that are still pending when the service
+  // is destroyed are discarded.
+  class timer_service {
+  public:
+    explicit timer_service(thread_pool& pool,
+                           timer_wheel::clock::duration const resolution
+                           = std::chrono::milliseconds(1))
+      : pool(pool), resolution(resolution), wheel(resolution)
+    {
+      driver = std::thread(&timer_service::run, this);
+    }
+
+    ~timer_service()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+      }
+      cv.notify_one();
+      driver.join();
+    }
+
+    timer_service(timer_service const&) = delete;
+    timer_service& operator=(timer_service const&) = delete;
+
+    timer_wheel::timer_id schedule_at(timer_wheel::clock::time_point const deadline,
+                                      timer_wheel::callback f)
+    {
+      return wake(wheel.schedule_at(deadline, std::move(f)));
+    }
+
+    timer_wheel::timer_id schedule_after(timer_wheel::clock::duration const delay,
+                                         timer_wheel::callback f)
+    {
+      return wake(wheel.schedule_after(delay, std::move(f)));
+    }
+
+    timer_wheel::timer_id schedule_every(timer_wheel::clock::duration const period,
+                                         timer_wheel::callback f)
+    {
+      return wake(wheel.schedule_every(period, std::move(f)));
+    }
+
+    bool cancel(timer_wheel::timer_id const id)
+    {
+      return wheel.cancel(id);
+    }
+
+    std::size_t size() const
+    {
+      return wheel.size();
+    }
+
+  private:
+    // The driver sleeps without a timeout while there are no timers.
+    timer_wheel::timer_id wake(timer_wheel::timer_id const id)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = true;
+      }
+      cv.notify_one();
+      return id;
+    }
+
+    void run()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!done) {
+        pending = false;
+        lock.unlock();
+        wheel.advance(timer_wheel::clock::now(),
+                      [this](timer_wheel::callback&& f) { pool.post(std::move(f)); });
+        auto const empty = wheel.size() == 0;
+        lock.lock();
+
+        if (empty)
+          cv.wait(lock, [this] { return done || pending; });
+        else
+          cv.wait_for(lock, resolution, [this] { return done; });
+      }
+    }
+
+    thread_pool& pool;
+    timer_wheel::clock::duration const resolution;
+    timer_wheel wheel;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool pending = false;
+    bool done = false;
+    std::thread driver;
+  };
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// A lock-free stack (R. K. Treiber, Systems Programming: Coping with Parallelism, 1986).
+
+// The stack is a singly linked list whose head is swapped with a compare-and-swap. The
+// difficulty is in pop(): it reads head->next before swinging the head, and by that time
+// another thread may have popped and deleted the node (a use after free), or popped it,
+// deleted it and pushed a new node at the same address, so that the compare-and-swap
+// succeeds with a stale next pointer (the ABA problem).
+
+// Both are avoided by reclaiming the popped nodes through an epoch_domain: pop() runs in
+// a critical section, and a node is only deleted when no thread that might have loaded
+// it is still in one, so its address cannot be reused while anyone can compare against
+// it. push() never dereferences a shared node and needs no critical section.
+
+#include "cache_padded.h"
+#include "epoch.h"
+#include <atomic>
+#include <utility>
+
+namespace conclib {
+  template <typename T>
+  class treiber_stack {
+  public:
+    explicit treiber_stack(epoch_domain& domain = epoch_domain::instance())
+      : domain(domain)
+    {
+    }
+
+    treiber_stack(treiber_stack const&) = delete;
+    treiber_stack& operator=(treiber_stack const&) = delete;
+
+    // Must not run concurrently with any other operation.
+    ~treiber_stack()
+    {
+      auto n = head.load(std::memory_order_relaxed);
+      while (n != nullptr)
+        delete std::exchange(n, n->next);
+    }
+
+    void push(T value)
+    {
+      auto const n = new node{ std::move(value), head.load(std::memory_order_relaxed) };
+      while (!head.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                         std::memory_order_relaxed))
+        ;
+    }
+
+    bool try_pop(T& value)
+    {
+      node* n;
+      {
+        auto const guard = domain.pin();
+
+        n = head.load(std::memory_order_acquire);
+        while (n != nullptr
+               && !head.compare_exchange_weak(n, n->next, std::memory_order_acquire,
+                                              std::memory_order_acquire))
+          ;
+      }
+
+      if (n == nullptr)
+        return false;
+
+      // The node is unlinked and only this thread can access its value. It is retired
+      // outside of the critical section, so that retire() may wait for the epoch.
+      value = std::move(n->value);
+      domain.retire(n);
+      return true;
+    }
+
+    bool empty() const
+    {
+      return head.load(std::memory_order_relaxed) == nullptr;
+    }
+
+  private:
+    struct node {
+      T value;
+      node* next;
+    };
+
+    epoch_domain& domain;
+    alignas(cache_line_size) std::atomic<node*> head{ nullptr };
+  };
+}